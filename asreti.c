@@ -1,3 +1,5 @@
+#include "reti.h"
+
 #include <assert.h>
 #include <ctype.h>
 #include <stdarg.h>
@@ -156,49 +158,6 @@ static int read_char(void) {
   return res;
 }
 
-// Allows compile time constants for bit-vectors (6-bit prefix of machine
-// code).
-
-#define CODE(A, B, C, D, E, F)                                                 \
-  ((((unsigned)(A)) << 31) | (((unsigned)(B)) << 30) |                         \
-   (((unsigned)(C)) << 29) | (((unsigned)(D)) << 28) |                         \
-   (((unsigned)(E)) << 27) | (((unsigned)(F)) << 26))
-
-// clang-format off
-
-// This enumeration has all our 6-bit most-significant prefix code-words.
-
-enum code {
-  LOAD =     CODE(0,1,0,0,0,0),
-  LOADIN1 =  CODE(0,1,0,1,0,0),
-  LOADIN2 =  CODE(0,1,1,0,0,0),
-  LOADI =    CODE(0,1,1,1,0,0),
-  STORE =    CODE(1,0,0,0,0,0),
-  STOREIN1 = CODE(1,0,0,1,0,0),
-  STOREIN2 = CODE(1,0,1,0,0,0),
-  MOVE =     CODE(1,0,1,1,0,0),
-  SUBI =     CODE(0,0,0,0,1,0),
-  ADDI =     CODE(0,0,0,0,1,1),
-  OPLUSI =   CODE(0,0,0,1,0,0),
-  ORI =      CODE(0,0,0,1,0,1),
-  ANDI =     CODE(0,0,0,1,1,0),
-  SUB =      CODE(0,0,1,0,1,0),
-  ADD =      CODE(0,0,1,0,1,1),
-  OPLUS =    CODE(0,0,1,1,0,0),
-  OR =       CODE(0,0,1,1,0,1),
-  AND =      CODE(0,0,1,1,1,0),
-  NOP =      CODE(1,1,0,0,0,0),
-  JUMPGT =   CODE(1,1,0,0,1,0),
-  JUMPEQ =   CODE(1,1,0,1,0,0),
-  JUMPGE =   CODE(1,1,0,1,1,0),
-  JUMPLT =   CODE(1,1,1,0,0,0),
-  JUMPNE =   CODE(1,1,1,0,1,0),
-  JUMPLE =   CODE(1,1,1,1,0,0),
-  JUMP =     CODE(1,1,1,1,1,0),
-};
-
-// clang-format on
-
 static int hexdigit(int ch) {
   if ('0' <= ch && ch <= '9')
     return ch - '0';
@@ -302,16 +261,7 @@ int main(int argc, char **argv) {
 
     int ch = read_char();
 
-    // These flags determine after parsing the name of the
-    // instruction whether we need to read 'S', 'D' and 'i'.
-
-    bool parse_source = false;     // Only for 'MOVE' necessary.
-    bool parse_destination = true; // Most instructions require 'D'.
-    bool parse_immediate = true;   // Most instructions require 'i'.
-
-    // This word accumulates the machine code of the parsed instruction.
-
-    unsigned code = NOP;
+    enum opcode opcode = ILLEGAL;
 
     switch (ch) {
 
@@ -332,202 +282,32 @@ int main(int argc, char **argv) {
       continue;
 
     default:
-      if (is_parsable_character(ch))
-        error("unexpected character '%c'", ch);
-      else if (isprint(ch))
-        error("invalid character '%c'", ch);
-      else
-        error("invalid character code '0x%02x'", ch);
-      break;
-
-      // The remaining parsing is done alphabetically with respect to the
-      // first character of the instruction read.
-
-    case 'A':
-      ch = read_char();
-      if (ch == 'D') {
-        ch = read_char();
-        if (ch == 'D') {
-          ch = read_char();
-          if (ch == ' ')
-            code = ADD; // D i
-          else if (ch == 'I') {
-            code = ADDI; // D i
-            ch = read_char();
-          } else
-            invalid_instruction();
-        } else
-          invalid_instruction();
-      } else if (ch == 'N') {
-        ch = read_char();
-        if (ch == 'D') {
-          ch = read_char();
-          if (ch == ' ')
-            code = AND; // D i
-          else if (ch == 'I') {
-            code = ANDI; // D i
-            ch = read_char();
-          } else
-            invalid_instruction();
-        } else
-          invalid_instruction();
-      } else
-        invalid_instruction();
-      break;
-
-    case 'J':
-      for (const char *p = "UMP"; *p; p++)
-        if (*p != read_char())
-          invalid_instruction();
-      ch = read_char();
-      if (ch == ' ')
-        code = JUMP; // i
-      else if (ch == '>') {
-        ch = read_char();
-        if (ch == ' ')
-          code = JUMPGT; // i
-        else if (ch == '=') {
-          code = JUMPGE; // i
-          ch = read_char();
-        } else
-          invalid_instruction();
-      } else if (ch == '=') {
-        code = JUMPEQ; // i
-        ch = read_char();
-      } else if (ch == '<') {
-        ch = read_char();
-        if (ch == ' ')
-          code = JUMPLT; // i
-        else if (ch == '=') {
-          code = JUMPLE; // i
-          ch = read_char();
-        } else
-          invalid_instruction();
-      } else if (ch == '!') {
-        ch = read_char();
-        if (ch == '=') {
-          code = JUMPNE; // i
-          ch = read_char();
-        } else
-          invalid_instruction();
-      } else
-        invalid_instruction();
-      parse_destination = false;
-      break;
-
-    case 'L':
-      for (const char *p = "OAD"; *p; p++)
-        if (*p != read_char())
-          invalid_instruction();
-      ch = read_char();
-      if (ch == ' ')
-        code = LOAD; // D i
-      else if (ch == 'I') {
-        ch = read_char();
-        if (ch == ' ')
-          code = LOADI; // D i
-        else if (ch == 'N') {
-          ch = read_char();
-          if (ch == '1')
-            code = LOADIN1; // D i
-          else if (ch == '2')
-            code = LOADIN2; // D i
-          else
-            invalid_instruction();
-          ch = read_char();
-        } else
-          invalid_instruction();
-      } else
-        invalid_instruction();
-      break;
-
-    case 'M':
-      for (const char *p = "OVE"; *p; p++)
-        if (*p != read_char())
-          invalid_instruction();
-      code = MOVE; // S D
-      parse_source = true;
-      parse_immediate = false;
-      ch = read_char();
-      break;
+      if (ch < 'A' || 'Z' < ch) {
+        if (is_parsable_character(ch))
+          error("unexpected character '%c'", ch);
+        else if (isprint(ch))
+          error("invalid character '%c'", ch);
+        else
+          error("invalid character code '0x%02x'", ch);
+      }
 
-    case 'N':
-      for (const char *p = "OP"; *p; p++)
-        if (*p != read_char())
-          invalid_instruction();
-      code = NOP;
-      ch = read_char();
-      parse_destination = false;
-      parse_immediate = false;
-      break;
+      // Read the name of the instruction and look it up in the table.
 
-    case 'O':
-      ch = read_char();
-      if (ch == 'P') {
-        for (const char *p = "LUS"; *p; p++)
-          if (*p != read_char())
-            invalid_instruction();
-        ch = read_char();
-        if (ch == ' ')
-          code = OPLUS; // D i;
-        else if (ch == 'I') {
-          code = OPLUSI; // D i;
-          ch = read_char();
-        } else
+      char mnemonic[16];
+      size_t length = 0;
+      do {
+        if (length == sizeof mnemonic - 1)
           invalid_instruction();
-      } else if (ch == 'R') {
+        mnemonic[length++] = ch;
         ch = read_char();
-        if (ch == ' ')
-          code = OR; // D i
-        else if (ch == 'I') {
-          code = ORI; // D i
-          ch = read_char();
-        } else
-          invalid_instruction();
-      } else
-        invalid_instruction();
-      break;
-
-    case 'S':
-      ch = read_char();
-      if (ch == 'T') {
-        parse_destination = false;
-        for (const char *p = "ORE"; *p; p++)
-          if (*p != read_char())
-            invalid_instruction();
-        ch = read_char();
-        if (ch == ' ')
-          code = STORE; // i
-        else if (ch == 'I') {
-          ch = read_char();
-          if (ch == 'N') {
-            ch = read_char();
-            if (ch == '1')
-              code = STOREIN1; // i
-            else if (ch == '2')
-              code = STOREIN2; // i
-            else
-              invalid_instruction();
-            ch = read_char();
-          } else
-            invalid_instruction();
-        } else
-          invalid_instruction();
-      } else if (ch == 'U') {
-        ch = read_char();
-        if (ch == 'B') {
-          ch = read_char();
-          if (ch == ' ')
-            code = SUB; // D i;
-          else if (ch == 'I') {
-            code = SUBI; // D i;
-            ch = read_char();
-          } else
-            invalid_instruction();
-        } else
-          invalid_instruction();
-      } else
+      } while (is_symbol_character(ch));
+      mnemonic[length] = 0;
+      opcode = reti_mnemonic(mnemonic);
+      if (opcode == ILLEGAL) {
+        if (ch != '\n' && ch != EOF)
+          size_line--; // Do not show the character after the name.
         invalid_instruction();
+      }
       break;
     }
 
@@ -537,8 +317,20 @@ int main(int argc, char **argv) {
     // After parsing the prefix the instruction and setting its code we
     // parse the remaining parts of an instruction ('S', 'D' and 'i').
 
+    // The operands of the instruction determine whether we need to read
+    // 'S' (only for 'MOVE'), 'D' and 'i'.
+
+    const unsigned operands = reti_instructions[opcode].operands;
+    const bool parse_source = operands == RETI_S_D;
+    const bool parse_destination = parse_source || operands == RETI_D_I;
+    const bool parse_immediate = operands == RETI_D_I || operands == RETI_I;
+
+    // This word accumulates the machine code of the parsed instruction.
+
+    unsigned code = reti_code(opcode);
+
     if (parse_source) {
-      assert(code == MOVE);
+      assert(opcode == MOVE);
       const unsigned S = parse_register("source");
       code |= S << 26;
       ch = read_char();
@@ -50,6 +50,13 @@ static void error(const char *fmt, ...) {
   exit(1);
 }
 
+// Eight hexadecimal digits with leading zeroes (without terminating zero).
+
+static void format_word(unsigned word, char *str) {
+  for (int i = 7; i >= 0; i--, word >>= 4)
+    str[i] = "0123456789abcdef"[word & 15];
+}
+
 static bool file_exists(const char *path) {
   struct stat buf;
   return !stat(path, &buf);
@@ -117,12 +124,28 @@ int main(int argc, char **argv) {
   else
     close_output_file = true;
 
+  // Lines are formatted by hand as 'printf("%-21s ; %08x %08x\n", ...)'
+  // would dominate the running time for large code files.
+
   unsigned code, disassembled = 0;
-  char instruction[disassembled_reti_code_length];
+  char line[disassembled_reti_code_length + 24];
   while (read_word(&code)) {
-    if (!disassemble_reti_code(code, instruction))
+    if (reti_opcode(code) == ILLEGAL)
       error("illegal instruction '0x%08x'", code);
-    printf("%-21s ; %08x %08x\n", instruction, disassembled++, code);
+    size_t length = format_reti_code(code, line);
+    while (length < 21)
+      line[length++] = ' ';
+    line[length++] = ' ';
+    line[length++] = ';';
+    line[length++] = ' ';
+    format_word(disassembled++, line + length);
+    length += 8;
+    line[length++] = ' ';
+    format_word(code, line + length);
+    length += 8;
+    line[length++] = '\n';
+    assert(length <= sizeof line);
+    fwrite(line, length, 1, output_file);
   }
 
   if (close_input_file)
@@ -1,13 +1,50 @@
 //----------------------------------------------------------------------------//
 
+// The just-in-time compiler ('--jit') generates x86-64 machine code and
+// needs 'mmap' to allocate executable memory.  It can be disabled with the
+// compile time flag 'NJIT' (see the '--no-jit' option of 'configure').
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(NJIT)
+#define JIT
+#endif
+
+// Regular code and data files are mapped into memory ('mmap') and their
+// words are used in place, which requires a little-endian host as ReTI
+// machine code is stored in little-endian order.  This can be disabled
+// with the compile time flag 'NMMAP' (see '--no-mmap' of 'configure').
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ &&    \
+    !defined(NMMAP)
+#define MMAP
+#endif
+
+// Running several data files in lockstep in batch mode ('--lanes') relies
+// on the vector extensions of GCC.  This can be disabled with the compile
+// time flag 'NLOCKSTEP'.
+
+#if defined(__GNUC__) && !defined(__clang__) && !defined(NLOCKSTEP)
+#define LOCKSTEP
+#endif
+
+// Hardware performance counters ('--hw-counters') are read through the
+// 'perf_event_open' system call of Linux.  This can be disabled with the
+// compile time flag 'NPERF' (see the '--no-perf' option of 'configure').
+
+#if defined(__linux__) && !defined(NPERF)
+#define PERF
+#endif
+
+//----------------------------------------------------------------------------//
+
 // clang-format off
 
 static const char *usage = 
 "usage: emreti [ -h | --help"
-#ifndef NSTEPPING
 " | -s | --step"
+#ifdef JIT
+" | -j | --jit"
 #endif
-" ] [ <steps> ] [ <code> [ <data> ] ] \n"
+" | -b | --batch ] [ <steps> ] [ <code> [ <data> ... ] ] \n"
 "\n"
 "with the following options:\n"
 "\n"
@@ -15,9 +52,31 @@ static const char *usage =
 "  -g | --debug  stop on unitialized data memory access\n"
 "  -i | --ignore ignore warnings on unitialized data\n"
 "  -f | --force  force reading non-binary assembler files\n"
-#ifndef NSTEPPING
 "  -s | --step   step through and print each instruction\n"
+#ifdef JIT
+"  -j | --jit    compile program to x86-64 machine code first\n"
+#endif
+"  -b | --batch  run the program on each of the given data files\n"
+"\n"
+"  --threads=<n>  number of threads in batch mode (default all processors)\n"
+"  --output=<dir> write dump of '<data>' to '<dir>/<data>.out' in batch mode\n"
+#ifdef LOCKSTEP
+"  --lanes=<n>    run up to 8 data files per thread in lockstep in batch mode\n"
 #endif
+"  --trace=<file> write binary trace of all steps (see 'trcreti')\n"
+"  --trace-from=<step>   only step or trace from this step on\n"
+"  --trace-to=<step>     only step or trace up to this step\n"
+"  --trace-pc=<lo>-<hi>  only step or trace instructions in this 'PC' range\n"
+"  --recorder=<n>        print last 'n' records (default 256, '0' disables)\n"
+"  --profile=<file>      write execution counts as annotated listing\n"
+"  --profile-hot         sort that listing by counts (hottest first)\n"
+"  --stats        print statistics and phase times to '<stderr>'\n"
+"  --sample=<hz>  sample 'PC' at this rate and print flat profile\n"
+"  --sample-folded=<file> write samples as folded stacks (flame graphs)\n"
+#ifdef PERF
+"  --hw-counters  print hardware counters of the execution to '<stderr>'\n"
+#endif
+"  --no-fuse      do not fuse instruction sequences and loops\n"
 "\n"
 "The '<code>' is a program in ReTI machine code and '<data>' some binary\n"
 "data which is loaded as data memory initially. If '<code>' is missing\n"
@@ -34,6 +93,12 @@ static const char *usage =
 "many instructions have been executed.  Otherwise it stops if either\n"
 "an uninitialized instruction is reached above the program code or an\n"
 "instruction which loops on itself (including illegal limit).\n"
+"\n"
+"In batch mode the code is only loaded once and then run on each data file\n"
+"(directories stand for all their files) in parallel.  The final data\n"
+"memory of each run is printed to '<stdout>' in the given order after a\n"
+"line '; <data>' unless '--output' is specified.  Errors only abort the\n"
+"run in which they occur, but then the exit code is one.\n"
 ;
 
 // clang-format on
@@ -42,67 +107,315 @@ static const char *usage =
 
 #include <assert.h>  // assert
 #include <ctype.h>   // isdigit
+#include <setjmp.h>  // jmp_buf setjmp longjmp
 #include <stdarg.h>  // va_list va_begin vfprintf va_end
 #include <stdbool.h> // bool
+#include <stdint.h>  // uint64_t int64_t INT32_MAX INT32_MIN SIZE_MAX
 #include <stdio.h>   // printf snprintf fputs fputc fflush fopen fclose
 #include <stdlib.h>  // calloc free exit
 #include <string.h>  // strcmp
 
 //----------------------------------------------------------------------------//
 
-#include <sys/stat.h>  // stat
-#include <sys/types.h> // stat
-#include <unistd.h>    // stat
+#include <dirent.h>       // opendir readdir closedir
+#include <pthread.h>      // pthread_create pthread_join pthread_mutex_lock
+#include <sched.h>        // sched_yield
+#include <signal.h>       // sigaction SIGPROF SIGUSR1
+#include <stdatomic.h>    // atomic_size_t atomic_load_explicit
+#include <sys/resource.h> // getrusage
+#include <sys/stat.h>     // stat
+#include <sys/time.h>     // setitimer
+#include <sys/types.h>    // stat
+#include <time.h>         // clock_gettime
+#include <unistd.h>       // stat sysconf
 
 /*------------------------------------------------------------------------*/
 
-#ifndef NSTEPPING
+#ifdef JIT
+#include <stddef.h> // offsetof
+#endif
 
-#include "disreti.h"
+#if defined(JIT) || defined(MMAP)
+#include <sys/mman.h> // mmap mprotect munmap
+#endif
 
+#ifdef PERF
+#include <errno.h>             // errno
+#include <linux/perf_event.h>  // perf_event_attr PERF_EVENT_IOC_ENABLE
+#include <sys/ioctl.h>         // ioctl
+#include <sys/syscall.h>       // SYS_perf_event_open
 #endif
 
+/*------------------------------------------------------------------------*/
+
+#include "disreti.h"
+#include "reti.h"
+#include "trcreti.h"
+
 //----------------------------------------------------------------------------//
-#ifdef LOGCAPACITY
 
-// The LOGCAPACITY can be specified with the configure script.
-// For instance './configure 16' uses 2^16 words.
+// The address space of ReTI has 2^32 words for both code and data memory.
+// The code memory is only allocated as needed while reading the code file
+// and the data memory is allocated lazily in pages (see 'struct memory').
 
-#define CAPACITY ((size_t)1 << LOGCAPACITY)
+#define CAPACITY ((size_t)1 << 32)
 
-#else
+//----------------------------------------------------------------------------//
 
-// If 'LOGCAPACITY' is not defined we are optimistic and use the default
-// which works on Linux, as follows.
+// Register codes as used in the 'S' and 'D' fields of instructions.
+
+enum { PC_CODE = 0, IN1_CODE = 1, IN2_CODE = 2, ACC_CODE = 3 };
+
+// Each code word is decoded exactly once after loading the program into a
+// 'decoded' instruction record.  The emulation loop then only needs to
+// dispatch on 'opcode' and does not have to extract bit-fields anymore.
+// The opcodes of the instruction set (see 'reti.h') are extended here.
+
+enum {
+  EXACT = ILLEGAL + 1, // Only used as 'fast_opcode' (see below).
+
+  // Fused instructions (superinstructions) are only used as 'fast_opcode'
+  // of the first instruction of a fused sequence (see 'fuse_code').
+
+  ADDI_JUMPGT,
+  ADDI_JUMPEQ,
+  ADDI_JUMPGE,
+  ADDI_JUMPLT,
+  ADDI_JUMPNE,
+  ADDI_JUMPLE,
+  SUBI_JUMPGT,
+  SUBI_JUMPEQ,
+  SUBI_JUMPGE,
+  SUBI_JUMPLT,
+  SUBI_JUMPNE,
+  SUBI_JUMPLE,
+  ADDI_LOADIN,
+  ADDI_STOREIN,
+  LOAD_ADDI_STORE,
+  LOAD_SUBI_STORE,
+  COUNT_LOOP,
+  FILL_LOOP,
+  COPY_LOOP,
+};
 
-// On Linux allocating 2^32 unsigned words for the code and data memories
-// succeeds as it actually only allocates virtual memory, which is mapped
-// (really allocated) only when used.  On other platforms you might want to
-// set the capacity closer to the actually needed memory.
+// With labels-as-values (a GCC extension also supported by Clang) every
+// instruction handler directly jumps to the handler of the next instruction,
+// which is stored in the decoded instruction ('direct threading').  This
+// avoids the single shared and thus badly predicted indirect branch of a
+// 'switch'.  Otherwise, or if 'NTHREADED' is defined, the portable 'switch'
+// dispatch is used.
 
-// Yields 2^32 words = 16 GB for each the code and data memory.
-//
-#define CAPACITY ((size_t)1 << 32)
+#if defined(__GNUC__) && !defined(NTHREADED)
+#define THREADED
+#endif
 
-// Yields 2^16 words = 256 KB for each the code and data memory.
-//
-// #define CAPACITY ((size_t)1 << 16) // yields 2^16 words = 256 KB
+// The fast emulation engine executes whole basic blocks, which end at jumps
+// or instructions writing the 'PC' (as well as illegal instructions).  The
+// 'fast_opcode' of all instructions which it does not execute itself is
+// 'EXACT', i.e., they are handed over to the exact (and slow) engine.  The
+// 'length' of an instruction is the number of instructions from it up to
+// and including the last instruction of its basic block.
 
+struct decoded {
+#ifdef THREADED
+  const void *handler; // Address of fast instruction handler label.
 #endif
-//----------------------------------------------------------------------------//
+  unsigned char opcode;      // Actually an 'enum opcode'.
+  unsigned char fast_opcode; // The 'opcode', 'EXACT' or fused.
+  unsigned char source;      // Register code 'S' (only used by 'MOVE').
+  unsigned char destination; // Register code 'D'.
+  unsigned immediate;        // Already sign-extended if signed.
+  unsigned length;           // Remaining instructions in basic block.
+};
+
+static struct decoded decode(unsigned I) {
+
+  const unsigned unsigned_immediate = I & 0xffffff;
+  const unsigned immediate_sign_bit = (unsigned_immediate >> 23) & 1;
+  const unsigned immediate_extension = immediate_sign_bit ? 0xff000000 : 0;
+  const unsigned signed_immediate = immediate_extension | unsigned_immediate;
+
+  struct decoded res;
+  res.opcode = reti_opcode(I);
+  res.source = (I >> 26) & 3;
+  res.destination = (I >> 24) & 3;
+  if (reti_instructions[res.opcode].immediate == RETI_SIGNED)
+    res.immediate = signed_immediate;
+  else
+    res.immediate = unsigned_immediate;
+
+  // Determine whether the fast engine can execute this instruction, which
+  // is not the case if it writes to (or 'MOVE' reads from) the 'PC'.
+
+  res.fast_opcode = res.opcode;
+  if (res.opcode == ILLEGAL)
+    res.fast_opcode = EXACT;
+  else if (res.opcode == MOVE && res.source == PC_CODE)
+    res.fast_opcode = EXACT;
+  else if (res.destination == PC_CODE &&
+           (res.opcode < STORE || res.opcode > STOREIN2) && res.opcode < NOP)
+    res.fast_opcode = EXACT;
+
+  return res;
+}
+
+// Instructions after which the fast engine has to check the next 'PC'.
 
-// These 'BV' macros allow to generate constant bit-vectors of the given
-// size at compile time.  Using functions would not work.
+static bool ends_basic_block(const struct decoded *decoded) {
+  if (decoded->fast_opcode == EXACT)
+    return true;
+  return decoded->opcode > NOP;
+}
+
+// Decode all code words and add an 'ILLEGAL' sentinel right after the last
+// instruction, which the fast engine never executes but hands over to the
+// exact engine.  It thus can just continue with the next decoded
+// instruction in a basic block without checking whether it reached the end
+// of the program code.
+
+static void compute_lengths(struct decoded *code, size_t size) {
+  unsigned length = 1;
+  for (size_t i = size + 1; i--;) {
+    if (ends_basic_block(code + i))
+      length = 1;
+    code[i].length = length++;
+  }
+}
 
-#define BV2(B1, B0) ((B1 << 1) | (B0 << 0))
+static struct decoded *decode_code(const unsigned *code, size_t size) {
+  struct decoded *res = malloc((size + 1) * sizeof *res);
+  if (!res)
+    return 0;
+  for (size_t i = 0; i != size; i++)
+    res[i] = decode(code[i]);
+  res[size] = decode(0);
+  assert(res[size].opcode == ILLEGAL);
+  compute_lengths(res, size);
+  return res;
+}
+
+// Frequent sequences of instructions in the same basic block are fused into
+// a superinstruction, which the fast engine executes with one dispatch.  Only
+// the 'fast_opcode' of the first instruction of the sequence is changed.
+// The fused handler executes the following instructions through their own
+// decoded records, which stay as they are for jumps into the sequence.
+// Since steps are accounted for per basic block anyway, fusion does not
+// change step counting and a fused handler can still exit to the exact
+// engine at any of the fused instructions.
+//
+//   ADDI|SUBI ACC i  +  JUMPcc j                ->  ADDI|SUBI_JUMPcc
+//   ADDI INx i       +  LOADINx D j             ->  ADDI_LOADIN
+//   ADDI INx i       +  STOREINx j              ->  ADDI_STOREIN
+//   LOAD ACC i  +  ADDI|SUBI ACC j  +  STORE k  ->  LOAD_ADDI|SUBI_STORE
+//
+// Further a basic block which jumps back to its own first instruction and
+// otherwise only contains 'ADDI', 'SUBI' and 'LOADI' instructions on
+// registers (and 'NOP') is a counting loop.  Its first instruction gets
+// 'COUNT_LOOP' as 'fast_opcode' and the fast engine computes the number of
+// iterations in closed form (see 'count_iterations').  Similar loops which
+// fill or copy consecutive words of data memory are executed in bulk
+// (see 'memory_loop').
+
+static bool fusing = true; // Disabled by '--no-fuse'.
+
+// Summary of the body of a memory loop, which in addition to 'ADDI', 'SUBI'
+// and 'NOP' instructions either stores 'ACC' with one 'STOREINx' (filling
+// memory) or first loads 'ACC' with one 'LOADINx ACC' and then stores it
+// (copying memory).  The base register of the store (and of the load) has
+// to move by one word in every iteration (in the same direction) and in
+// copy loops 'ACC' is only written by the load.  Offsets are relative to
+// the register values at the start of an iteration.
+
+struct loop {
+  const struct decoded *load, *store;
+  unsigned load_offset, store_offset; // Including the immediate.
+  unsigned value_offset;              // Added to 'ACC' before storing it.
+  unsigned delta[4];                  // Added to registers per iteration.
+};
 
-#define BV4(B3, B2, B1, B0) ((B3 << 3) | (B2 << 2) | (B1 << 1) | (B0 << 0))
+static unsigned base_register(const struct decoded *decoded) {
+  const unsigned opcode = decoded->opcode;
+  return opcode == LOADIN1 || opcode == STOREIN1 ? IN1_CODE : IN2_CODE;
+}
 
-#define BV5(B4, B3, B2, B1, B0)                                                \
-  ((B4 << 4) | (B3 << 3) | (B2 << 2) | (B1 << 1) | (B0 << 0))
+// Returns the 'fast_opcode' of the first instruction of the memory loop or
+// 'EXACT' if the body does not match.
+
+static unsigned memory_loop(const struct decoded *head,
+                            const struct decoded *jump, struct loop *loop) {
+  memset(loop, 0, sizeof *loop);
+  bool computes_ACC = false;
+  for (const struct decoded *d = head; d != jump; d++) {
+    const unsigned opcode = d->opcode, D = d->destination;
+    if (opcode == ADDI || opcode == SUBI) {
+      loop->delta[D] += opcode == ADDI ? d->immediate : -d->immediate;
+      computes_ACC |= D == ACC_CODE;
+    } else if ((opcode == LOADIN1 || opcode == LOADIN2) && D == ACC_CODE &&
+               !loop->load && !loop->store) {
+      loop->load = d;
+      loop->load_offset = loop->delta[base_register(d)] + d->immediate;
+    } else if ((opcode == STOREIN1 || opcode == STOREIN2) && !loop->store) {
+      loop->store = d;
+      loop->store_offset = loop->delta[base_register(d)] + d->immediate;
+      loop->value_offset = loop->delta[ACC_CODE];
+    } else if (opcode != NOP)
+      return EXACT;
+  }
+  if (!loop->store)
+    return EXACT;
+  const unsigned direction = loop->delta[base_register(loop->store)];
+  if (direction != 1 && direction != ~0u)
+    return EXACT;
+  if (!loop->load)
+    return FILL_LOOP;
+  if (computes_ACC || loop->delta[base_register(loop->load)] != direction)
+    return EXACT;
+  return COPY_LOOP;
+}
 
-#define BV6(B5, B4, B3, B2, B1, B0)                                            \
-  ((B5 << 5) | (B4 << 4) | (B3 << 3) | (B2 << 2) | (B1 << 1) | (B0 << 0))
+static void fuse_code(struct decoded *code, size_t size) {
+  for (size_t i = 0; i != size; i++) {
+    struct decoded *d = code + i;
+    if (d->length < 2 || d->fast_opcode != d->opcode ||
+        d[1].fast_opcode != d[1].opcode)
+      continue;
+    const unsigned first = d[0].opcode, second = d[1].opcode;
+    if (first == LOAD && d->destination == ACC_CODE && d->length > 2 &&
+        (second == ADDI || second == SUBI) && d[1].destination == ACC_CODE &&
+        d[2].opcode == STORE && d[2].fast_opcode == STORE)
+      d->fast_opcode = second == ADDI ? LOAD_ADDI_STORE : LOAD_SUBI_STORE;
+    else if ((first == ADDI || first == SUBI) && d->destination == ACC_CODE &&
+             JUMPGT <= second && second <= JUMPLE)
+      d->fast_opcode = (first == ADDI ? ADDI_JUMPGT : SUBI_JUMPGT) +
+                       (second - JUMPGT);
+    else if (first == ADDI && d->destination == IN1_CODE &&
+             (second == LOADIN1 || second == STOREIN1))
+      d->fast_opcode = second == LOADIN1 ? ADDI_LOADIN : ADDI_STOREIN;
+    else if (first == ADDI && d->destination == IN2_CODE &&
+             (second == LOADIN2 || second == STOREIN2))
+      d->fast_opcode = second == LOADIN2 ? ADDI_LOADIN : ADDI_STOREIN;
+  }
+  for (size_t i = 0; i != size; i++) {
+    const struct decoded *jump = code + i;
+    if (jump->opcode < JUMPGT || jump->opcode > JUMP)
+      continue;
+    const unsigned head = (unsigned)i + jump->immediate;
+    if (head >= i || code[head].length != i - head + 1)
+      continue;
+    bool counting = true;
+    for (const struct decoded *d = code + head; counting && d != jump; d++)
+      counting = d->opcode == ADDI || d->opcode == SUBI ||
+                 d->opcode == LOADI || d->opcode == NOP;
+    if (counting)
+      code[head].fast_opcode = COUNT_LOOP;
+    else {
+      struct loop loop;
+      const unsigned fast_opcode = memory_loop(code + head, jump, &loop);
+      if (fast_opcode != EXACT)
+        code[head].fast_opcode = fast_opcode;
+    }
+  }
+}
 
 //----------------------------------------------------------------------------//
 
@@ -117,6 +430,51 @@ struct parser {
 
 //----------------------------------------------------------------------------//
 
+// In batch mode ('--batch') one code image is run on many data files in
+// parallel.  Each such run collects its messages in its own 'messages'
+// stream, which is printed in input order after the run completed, and
+// errors only abort that run (through 'abort') instead of exiting.
+
+struct run {
+  const char *path;          // Data file.
+  FILE *input;               // Data file while being read.
+  FILE *output, *messages;   // Final data memory and messages.
+  char *output_buffer;       // Contents of 'output' (unless written to file).
+  char *messages_buffer;     // Contents of 'messages'.
+  size_t output_bytes, messages_bytes;
+  jmp_buf abort;
+  bool failed, done;
+};
+
+static _Thread_local struct run *running; // Run of this thread (if any).
+
+// In stepping mode messages have to be ordered with the printed steps,
+// which are printed on a separate thread (see 'print_steps' below).
+
+static void drain_steps(void);
+static bool queue_warning(const char *, va_list);
+
+// Errors and stopping abnormally print the flight recorder after their
+// message (see 'recorder' below).
+
+static void dump_recorder(void);
+
+static FILE *start_message(const char *type) {
+  if (running) {
+    fprintf(running->messages, "emreti: %s: %s: ", running->path, type);
+    return running->messages;
+  }
+  drain_steps();
+  fflush(stdout);
+  fprintf(stderr, "emreti: %s: ", type);
+  return stderr;
+}
+
+static void abort_run(void) {
+  if (running)
+    longjmp(running->abort, 1);
+}
+
 // Exit with error message with 'printf' style usage.
 //
 // The following declaration lets the compiler produce error messages if the
@@ -126,13 +484,14 @@ struct parser {
 static void die(const char *, ...) __attribute__((format(printf, 1, 2)));
 
 static void die(const char *fmt, ...) {
-  fflush(stdout);
-  fputs("emreti: error: ", stderr);
+  FILE *file = start_message("error");
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
+  vfprintf(file, fmt, ap);
   va_end(ap);
-  fputc('\n', stderr);
+  fputc('\n', file);
+  dump_recorder();
+  abort_run();
   exit(1);
 }
 
@@ -141,14 +500,18 @@ static void die(const char *fmt, ...) {
 static void warn(const char *, ...) __attribute__((format(printf, 1, 2)));
 
 static void warn(const char *fmt, ...) {
-  fflush(stdout);
-  fputs("emreti: warning: ", stderr);
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
+  const bool queued = queue_warning(fmt, ap);
   va_end(ap);
-  fputc('\n', stderr);
-  fflush(stderr);
+  if (queued)
+    return;
+  FILE *file = start_message("warning");
+  va_start(ap, fmt);
+  vfprintf(file, fmt, ap);
+  va_end(ap);
+  fputc('\n', file);
+  fflush(file);
 }
 
 //----------------------------------------------------------------------------//
@@ -171,6 +534,31 @@ static bool is_number_string(const char *str) {
   return true;
 }
 
+// Parse a decimal or hexadecimal (with '0x' prefix) number of the option
+// 'arg' which is at most 'max'.
+
+static size_t parse_number(const char *arg, const char *str, size_t max) {
+  const size_t base = str[0] == '0' && str[1] == 'x' ? 16 : 10;
+  if (base == 16)
+    str += 2;
+  if (!*str)
+    die("missing number in '%s'", arg);
+  size_t res = 0;
+  for (const char *p = str; *p; p++) {
+    int digit;
+    if (isdigit(*p))
+      digit = *p - '0';
+    else if (base == 16 && 'a' <= *p && *p <= 'f')
+      digit = 10 + (*p - 'a');
+    else
+      die("invalid number in '%s'", arg);
+    if ((max - digit) / base < res)
+      die("number in '%s' too large", arg);
+    res = base * res + digit;
+  }
+  return res;
+}
+
 //----------------------------------------------------------------------------//
 
 static void init_parser(struct parser *parser, FILE *file, const char *name) {
@@ -194,13 +582,15 @@ static void error(struct parser *, const char *, ...)
     __attribute((format(printf, 2, 3)));
 
 static void error(struct parser *parser, const char *fmt, ...) {
-  fprintf(stderr, "emreti: parse error: in word %zu after %zu bytes in '%s': ",
-          parser->words, parser->bytes, parser->name);
+  FILE *file = start_message("parse error");
+  fprintf(file, "in word %zu after %zu bytes in '%s': ", parser->words,
+          parser->bytes, parser->name);
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
+  vfprintf(file, fmt, ap);
   va_end(ap);
-  fputc('\n', stderr);
+  fputc('\n', file);
+  abort_run();
   exit(1);
 }
 
@@ -230,724 +620,3874 @@ static bool next_word(struct parser *parser, unsigned *word_ptr) {
   return true;
 }
 
-//----------------------------------------------------------------------------//
-
-// The whole emulator runs in the main function.
+#ifdef MMAP
 
-int main(int argc, char **argv) {
+// Map a regular file into memory and return the number of its words in
+// 'words_ptr'.  The mapping is private and thus writing to it (if allowed
+// by 'protection') only changes a copy of the written host pages but not
+// the file.  Returns zero if the file is not regular (a pipe or terminal
+// for instance), empty or not a sequence of complete words, or if mapping
+// fails.  Then the file has to be read word by word with 'next_word'.
 
-  //--------------------------------------------------------------------------//
-  // First parse command line options.
+static unsigned *map_file(FILE *file, int protection, size_t *words_ptr) {
+  struct stat buf;
+  if (fstat(fileno(file), &buf) || !S_ISREG(buf.st_mode))
+    return 0;
+  const size_t bytes = buf.st_size;
+  if (!bytes || bytes % sizeof(unsigned))
+    return 0;
+  void *res = mmap(0, bytes, protection, MAP_PRIVATE, fileno(file), 0);
+  if (res == MAP_FAILED)
+    return 0;
+  *words_ptr = bytes / sizeof(unsigned);
+  return res;
+}
 
-#ifndef NSTEPPING
-  bool step = false;
-#endif
-  size_t steps = 0;
-  int debug = 0; //-1=ignore, 0=warning, 1=abort.
-  bool force = 0;
+// Same as what 'next_char' determines for every byte read.
 
-  const char *code_path = 0;
-  const char *data_path = 0;
-  const char *limit_string = 0;
+static void mapped_parser(struct parser *parser, const unsigned *words,
+                          size_t size) {
+  parser->words = size;
+  parser->bytes = size * sizeof *words;
+  const unsigned char *bytes = (const unsigned char *)words;
+  for (size_t i = 0; !parser->binary && i != parser->bytes; i++)
+    if (bytes[i] != ' ' && bytes[i] != '\n' && !isprint(bytes[i]))
+      parser->binary = true;
+}
 
-  for (int i = 1; i != argc; i++) {
-    const char *arg = argv[i];
-    if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
-      fputs(usage, stdout);
-      exit(0);
-    } else if (!strcmp(arg, "-s") || !strcmp(arg, "--step")) {
-#ifndef NSTEPPING
-      step = true;
-#else
-      die("invalid option '%s' "
-          "(configured and compiled without stepping support)",
-          arg);
 #endif
-    } else if (!strcmp(arg, "-g") || !strcmp(arg, "--debug"))
-      debug = 1;
-    else if (!strcmp(arg, "-i") || !strcmp(arg, "--ignore"))
-      debug = -1;
-    else if (!strcmp(arg, "-f") || !strcmp(arg, "--force"))
-      force = true;
-    else if (arg[0] == '-' && arg[1])
-      die("invalid option '%s' (try '-h')", arg);
-    else if (is_number_string(arg)) {
-      if (limit_string)
-        die("two steps limits '%s' and '%s'", limit_string, arg);
-      if (file_exists(arg))
-        die("steps limit '%s' matches file '%s'", arg, arg);
-      limit_string = arg;
-    } else if (!code_path)
-      code_path = arg;
-    else if (!data_path)
-      data_path = arg;
-    else
-      die("more than two files specified '%s', '%s' and '%s' (try '-h')",
-          code_path, data_path, arg);
-  }
-
-  const size_t max_limit = ~(size_t)0;
-  size_t limit = max_limit;
-  if (limit_string) {
-    limit = 0;
-    const char *p = limit_string;
-    int ch;
-    while ((ch = *p++)) {
-      assert(isdigit(ch));
-      if (max_limit / 10 < limit)
-        die("maximum steps limit exceeded in '%s'", limit_string);
-      limit *= 10;
-      int digit = ch - '0';
-      if (max_limit - digit < limit)
-        die("maximum steps limit exceeded in '%s'", limit_string);
-      limit += digit;
-    }
-  }
-
-  if (code_path && data_path)
-    if (!strcmp(code_path, "-") && !strcmp(data_path, "-"))
-      die("can not read both code and data from '<stdin>'");
 
-  //--------------------------------------------------------------------------//
-
-  // The actual state of our ReTI machine is saved in this 'reti' structure.
-  //
-  // We can assume that 'unsigned' is a 32-bit word and thus we use 'unsigned'
-  // whenever we refer to a register, data or machine word of ReTI.
-  //
-  struct {
-    unsigned *code, *data;
-    unsigned PC, ACC, IN1, IN2;
-  } reti;
-
-  reti.PC = reti.ACC = reti.IN1 = reti.IN2 = 0;
-
-  // The shadow state determines valid (used) code and data ranges.
-
-  struct {
-    bool *valid;
-    size_t code, data;
-  } shadow;
-
-  //--------------------------------------------------------------------------//
+//----------------------------------------------------------------------------//
 
-  // Allocate code, data and valid memory.
+// The data memory covers the whole 32-bit address space but only the pages
+// which are actually written to are allocated.  It is organized as a
+// two-level page table.  The upper 'LOG_TABLE_SIZE' bits of an address
+// select a table of pages, the next 'LOG_TABLE_SIZE' bits a page in that
+// table, and the lower 'LOG_PAGE_SIZE' bits the word in that page.  Both
+// tables and pages are allocated (zero initialized) on the first write.
+// Each page keeps track of which of its words are valid (initialized) in
+// a bit-map of 64-bit words.  Thus reading an invalid word or a word on a
+// missing page yields zero.
+//
+// The initial data can be given as a memory mapped 'image' of the data file
+// (see 'map_file').  Its pages are only created when first accessed and
+// then use the words of the image in place, except for a last incomplete
+// page, which gets a copy.  Since the image is mapped private writing to it
+// only copies the written host pages (copy-on-write).
+
+#define LOG_PAGE_SIZE 12
+#define LOG_TABLE_SIZE 10
+
+#define PAGE_SIZE ((size_t)1 << LOG_PAGE_SIZE)
+#define TABLE_SIZE ((size_t)1 << LOG_TABLE_SIZE)
+
+#define TABLE_INDEX(ADDRESS) ((ADDRESS) >> (LOG_PAGE_SIZE + LOG_TABLE_SIZE))
+#define PAGE_INDEX(ADDRESS) (((ADDRESS) >> LOG_PAGE_SIZE) & (TABLE_SIZE - 1))
+#define WORD_INDEX(ADDRESS) ((ADDRESS) & (PAGE_SIZE - 1))
+
+#define LOG_VALID_BITS 6
+#define VALID_BITS ((size_t)1 << LOG_VALID_BITS)
+
+struct page {
+  unsigned *words; // Either 'storage' or in the data image.
+  uint64_t valid[PAGE_SIZE / VALID_BITS];
+  unsigned address; // Of the first word.
+  unsigned storage[];
+};
 
-  reti.code = calloc(CAPACITY, sizeof *reti.code);
-  if (!reti.code)
-    die("can not allocate code");
-  shadow.code = 0;
+struct table {
+  struct page *pages[TABLE_SIZE];
+};
 
-  reti.data = calloc(CAPACITY, sizeof *reti.data);
-  if (!reti.data)
-    die("can not allocate data");
-  shadow.data = 0;
+// All allocated pages are also kept in the order of their allocation in
+// 'pages', such that counting, printing and releasing memory only visits
+// those pages instead of scanning the page tables.
 
-  shadow.valid = calloc(CAPACITY, sizeof *shadow.valid);
-  if (!shadow.valid)
-    die("can not allocate valid bit-map");
+struct memory {
+  struct table *tables[TABLE_SIZE];
+  struct page **pages;
+  size_t size_pages, capacity_pages;
+  unsigned *image;   // Memory mapped data file (if not zero).
+  size_t size_image; // Number of words in 'image'.
+};
 
-    // Read code file.
+static struct page *find_page(const struct memory *memory, unsigned address) {
+  const struct table *table = memory->tables[TABLE_INDEX(address)];
+  return table ? table->pages[PAGE_INDEX(address)] : 0;
+}
 
-#ifndef NSTEPPING
-  char instruction_format[16];
-#endif
+// Find the page of the address and allocate it if it is missing.
 
-  {
-    FILE *code_file = 0;
-    bool close_code_file = false;
-    if (!code_path || !strcmp(code_path, "-"))
-      code_path = "<stdin>", code_file = stdin;
-    else if (!file_exists(code_path))
-      die("code file '%s' does not exist", code_path);
-    else if (!(code_file = fopen(code_path, "r")))
-      die("can not read code file '%s'", code_path);
-    else
-      close_code_file = true;
-#ifndef NSTEPPING
-    char instruction[32];
-    size_t instruction_length = 0;
-#endif
-    struct parser parser;
-    init_parser(&parser, code_file, code_path);
-    unsigned code;
-    while (next_word(&parser, &code)) {
-      if (shadow.code == CAPACITY)
-        die("capacity of code area reached");
-      else
-        reti.code[shadow.code++] = code;
-#ifndef NSTEPPING
-      if (disassemble_reti_code(code, instruction)) {
-        size_t length = strlen(instruction);
-        if (length > instruction_length)
-          instruction_length = length;
+static struct page *get_page(struct memory *memory, unsigned address) {
+  struct table **table_ptr = memory->tables + TABLE_INDEX(address);
+  struct table *table = *table_ptr;
+  if (!table) {
+    table = calloc(1, sizeof *table);
+    if (!table)
+      die("can not allocate data page table");
+    *table_ptr = table;
+  }
+  struct page **page_ptr = table->pages + PAGE_INDEX(address);
+  struct page *page = *page_ptr;
+  if (!page) {
+    const unsigned first = address & ~(unsigned)(PAGE_SIZE - 1);
+    const size_t imaged =
+        first < memory->size_image ? memory->size_image - first : 0;
+    if (imaged >= PAGE_SIZE) {
+      page = calloc(1, sizeof *page);
+      if (!page)
+        die("can not allocate data page");
+      page->words = memory->image + first;
+      memset(page->valid, 0xff, sizeof page->valid);
+    } else {
+      page = calloc(1, sizeof *page + PAGE_SIZE * sizeof *page->storage);
+      if (!page)
+        die("can not allocate data page");
+      page->words = page->storage;
+      for (size_t i = 0; i != imaged; i++) {
+        page->words[i] = memory->image[first + i];
+        page->valid[i >> LOG_VALID_BITS] |= (uint64_t)1
+                                            << (i & (VALID_BITS - 1));
       }
-#endif
     }
-    if (!force && parser.words && !parser.binary) {
-      const char *magic = "; ranreti ";
-      const size_t magic_len = strlen(magic);
-      const size_t compare_len =
-          magic_len < parser.bytes ? magic_len : parser.bytes;
-      if (!strncmp(magic, (char *)reti.code, compare_len))
-        die("non-binary '%s' looks like an assembler file and not machine code "
-            "(use '-f' to force reading)",
-            code_path);
-      else if (parser.words > 2)
-        die("non-binary '%s' with %zu words does not look like machine code "
-            "(use '-f' to force reading)",
-            code_path, parser.words);
-      else
-        warn("non-binary '%s' with %s does not look like machine code "
-             "(use '-f' to squelch this warning)",
-             code_path, parser.words == 1 ? "one word" : "two words");
+    page->address = first;
+    *page_ptr = page;
+    if (memory->size_pages == memory->capacity_pages) {
+      memory->capacity_pages =
+          memory->capacity_pages ? 2 * memory->capacity_pages : 16;
+      memory->pages = realloc(memory->pages, memory->capacity_pages *
+                                                 sizeof *memory->pages);
+      if (!memory->pages)
+        die("can not reallocate data pages");
     }
-    if (close_code_file)
-      fclose(code_file);
-#ifndef NSTEPPING
-    sprintf(instruction_format, "%%-%zus", instruction_length);
-#endif
+    memory->pages[memory->size_pages++] = page;
   }
+  return page;
+}
 
-  // Read data file.
+// Find the page of the address for reading, which only needs to allocate
+// it if it is part of the data image.
 
-  if (data_path) {
-    FILE *data_file = 0;
-    bool close_data_file = false;
-    if (!strcmp(data_path, "-"))
-      data_path = "<stdin>", data_file = stdin;
-    else if (!file_exists(data_path))
-      die("data file '%s' does not exist", data_path);
-    else if (!(data_file = fopen(data_path, "r")))
-      die("can not read data file '%s'", data_path);
-    struct parser parser;
-    init_parser(&parser, data_file, data_path);
-    unsigned word;
-    while (next_word(&parser, &word)) {
-      if (shadow.data == CAPACITY)
-        die("capacity of data area reached");
-      else {
-        shadow.valid[shadow.data] = true;
-        reti.data[shadow.data] = word;
-        shadow.data++;
-      }
-    }
-    if (close_data_file)
-      fclose(data_file);
-  }
+static struct page *load_page(struct memory *memory, unsigned address) {
+  struct page *page = find_page(memory, address);
+  if (!page && address < memory->size_image)
+    page = get_page(memory, address);
+  return page;
+}
 
-  //--------------------------------------------------------------------------//
+// Create all pages of the data image, which is needed before visiting the
+// list of all pages.
 
-  // Simulate code on data.
+static void load_image(struct memory *memory) {
+  for (size_t address = 0; address < memory->size_image; address += PAGE_SIZE)
+    load_page(memory, address);
+}
 
-#ifndef NSTEPPING // If the compile time flag 'STEPPING' is set (default).
+static bool valid_word(const struct page *page, size_t word) {
+  return (page->valid[word >> LOG_VALID_BITS] >> (word & (VALID_BITS - 1))) &
+         1;
+}
 
-  // Buffers for printing step information.
+static bool valid_memory(struct memory *memory, unsigned address) {
+  const struct page *page = load_page(memory, address);
+  return page && valid_word(page, WORD_INDEX(address));
+}
 
-  // e.g., "SUBI ACC 0x123456"
-  //
-  char instruction[32];
+static unsigned read_memory(struct memory *memory, unsigned address) {
+  const struct page *page = load_page(memory, address);
+  return page ? page->words[WORD_INDEX(address)] : 0;
+}
 
-  // e.g., "ACC = ACC - [0x123456] = 1193047 - 1193046 = 1 = [0x00000001]"
-  //
-  char action[128];
+// Written data becomes valid.
 
-#define INSTRUCTION(...)                                                       \
-  do {                                                                         \
-    if (step)                                                                  \
-      snprintf(instruction, 32, __VA_ARGS__);                                  \
-  } while (0)
+static void write_memory(struct memory *memory, unsigned address,
+                         unsigned word) {
+  struct page *page = get_page(memory, address);
+  const size_t index = WORD_INDEX(address);
+  page->words[index] = word;
+  page->valid[index >> LOG_VALID_BITS] |= (uint64_t)1
+                                          << (index & (VALID_BITS - 1));
+}
 
-#define ACTION(...)                                                            \
-  do {                                                                         \
-    if (step)                                                                  \
-      snprintf(action, 128, __VA_ARGS__);                                      \
-  } while (0)
+// Make the given range of words of the page valid.
+
+static void validate_words(struct page *page, size_t word, size_t words) {
+  while (words) {
+    const size_t bit = word & (VALID_BITS - 1);
+    const size_t bits = words < VALID_BITS - bit ? words : VALID_BITS - bit;
+    const uint64_t ones = bits == VALID_BITS ? ~(uint64_t)0
+                                             : ((uint64_t)1 << bits) - 1;
+    page->valid[word >> LOG_VALID_BITS] |= ones << bit;
+    word += bits;
+    words -= bits;
+  }
+}
 
-#else // If compile time flag 'STEPPING' is not set ignore step code.
+// Number of valid words, i.e., the number of words printed at the end.
 
-#define INSTRUCTION(FMT, ...) /**/
-#define ACTION(FMT, ...)      /**/
+static size_t count_memory(struct memory *memory) {
+  load_image(memory);
+  size_t res = 0;
+  for (size_t i = 0; i != memory->size_pages; i++) {
+    const struct page *page = memory->pages[i];
+    for (size_t j = 0; j != PAGE_SIZE / VALID_BITS; j++)
+      res += __builtin_popcountll(page->valid[j]);
+  }
+  return res;
+}
 
+static void release_memory(struct memory *memory) {
+  for (size_t i = 0; i != memory->size_pages; i++)
+    free(memory->pages[i]);
+  free(memory->pages);
+  for (size_t i = 0; i != TABLE_SIZE; i++)
+    free(memory->tables[i]);
+#ifdef MMAP
+  if (memory->image)
+    munmap(memory->image, memory->size_image * sizeof *memory->image);
 #endif
+}
 
-  //==========================================================================//
+//----------------------------------------------------------------------------//
 
-  // Run the emulation until we get to a self-loop or reach undefined code.
+// The actual state of our ReTI machine is saved in this 'reti' structure.
+//
+// We can assume that 'unsigned' is a 32-bit word and thus we use 'unsigned'
+// whenever we refer to a register, data or machine word of ReTI.
+//
+// The registers can also be accessed through their register code as index
+// into 'R', which is how the decoded instructions refer to them.
+
+struct reti {
+  unsigned *code;
+  struct decoded *decoded;
+  struct memory data;
+  union {
+    unsigned R[4];
+    struct {
+      unsigned PC, IN1, IN2, ACC;
+    };
+  };
+};
 
-  for (;;) {
+// The shadow state determines the valid (used) code range.
 
-    if (steps++ == limit) {
-      warn("steps limit '%zu' reached", limit);
-      break;
-    }
+struct shadow {
+  size_t code;
+};
 
-    const unsigned PC = reti.PC;
-    const unsigned IN1 = reti.IN1;
-    const unsigned IN2 = reti.IN2;
-    const unsigned ACC = reti.ACC;
+// Both engines below work on this combined state of an emulation.
 
-    if (PC >= shadow.code) {
-#ifndef NSTEPPING
-      if (step) {
-        if (steps == 1)
-          fputs("STEPS    PC       CODE     IN1      IN2      ACC\n", stdout);
-        printf("%-8zu %08x ........ %08x %08x %08x <undefined>\n", steps, PC,
-               IN1, IN2, ACC);
-      }
-#endif
-      if (PC != shadow.code)
-        warn("stopping at undefined 'code[0x%08x]' above 0x%08x", PC,
-             (unsigned)(shadow.code - 1));
-      break;
-    }
-    const unsigned I = reti.code[PC];
+struct emulator {
+  struct reti reti;
+  struct shadow shadow;
+  size_t steps;
+  uint64_t uninitialized; // Uninitialized reads (only with 'counters').
+};
 
-    const unsigned I31to30 = I >> 30;
-    const unsigned I31to28 = I >> 28;
-    const unsigned I31to27 = I >> 27;
-    const unsigned I31to26 = I >> 26;
-    const unsigned I27to26 = (I >> 26) & 3;
-    const unsigned I25to24 = (I >> 24) & 3;
-    const unsigned I23toI0 = I & 0xffffff;
+// Options which are the same for all engines.
 
-    const unsigned i = I23toI0;
-    const unsigned unsigned_immediate = i;
-    const unsigned immediate_sign_bit = (i >> 23) & 1;
-    const unsigned immediate_extension = immediate_sign_bit ? 0xff000000 : 0;
-    const unsigned signed_immediate = immediate_extension | unsigned_immediate;
+static size_t limit = ~(size_t)0; // Maximum number of steps.
+static int debug = 0;             //-1=ignore, 0=warning, 1=abort.
 
-#ifndef NSTEPPING
-    const int immediate_sign_char = immediate_sign_bit ? '-' : '+';
-    const int abs_immediate = abs((int)signed_immediate);
-#endif
+static bool step;                   // Print each instruction (exactly).
+static unsigned instruction_length; // Aligns the 'INSTRUCTION' column.
 
-    unsigned S = 0;
-    const char *S_symbol = 0;
+//----------------------------------------------------------------------------//
 
-    switch (I27to26) {
-    case BV2(0, 0):
-      S = PC;
-      S_symbol = "PC";
-      break;
-    case BV2(0, 1):
-      S = IN1;
-      S_symbol = "IN1";
-      break;
-    case BV2(1, 0):
-      S = IN2;
-      S_symbol = "IN2";
-      break;
-    case BV2(1, 1):
-      S = ACC;
-      S_symbol = "ACC";
-      break;
-    }
+// With '--trace=<trace>' the exact engine appends a binary record for each
+// step to a large buffer which is only written when full (or at exit).  It
+// is formatted by 'trcreti' later (see 'trcreti.h').
 
-    // Determine pointer address of destination register (in any case).
+#define TRACE_BUFFER (1u << 16) // Records (of 40 bytes) buffered.
 
-    unsigned *D_pointer = 0, D = 0;
-    const char *D_symbol = 0;
+static struct {
+  const char *path;
+  FILE *file;
+  struct reti_trace_record *buffer;
+  size_t size;
+} trace;
+
+static bool flush_trace(void) {
+  const size_t size = trace.size;
+  trace.size = 0;
+  return fwrite(trace.buffer, sizeof *trace.buffer, size, trace.file) == size;
+}
 
-    switch (I25to24) {
-    case BV2(0, 0):
-      D_pointer = &reti.PC;
-      D_symbol = "PC";
-      break;
-    case BV2(0, 1):
-      D_pointer = &reti.IN1;
-      D_symbol = "IN1";
-      break;
-    case BV2(1, 0):
-      D_pointer = &reti.IN2;
-      D_symbol = "IN2";
-      break;
-    case BV2(1, 1):
-      D_pointer = &reti.ACC;
-      D_symbol = "ACC";
-      break;
-    }
+// Also called at exit, which makes sure that we get the complete trace
+// even if the emulation dies (say on an illegal instruction).  As 'die'
+// can not be used during exit we only warn here.
+
+static void close_trace(void) {
+  if (!trace.file)
+    return;
+  bool written = flush_trace();
+  if (fclose(trace.file))
+    written = false;
+  if (!written)
+    warn("can not write trace file '%s'", trace.path);
+  trace.file = 0;
+  free(trace.buffer);
+}
 
-#ifdef NSTEPPING
-    (void)S_symbol; // To avoid compiler warning not using 'S_symbol'.
-    (void)D_symbol; // To avoid compiler warning not using 'D_symbol'.
-#endif
+static void open_trace(void) {
+  if (!(trace.file = fopen(trace.path, "w")))
+    die("can not write trace file '%s'", trace.path);
+  trace.buffer = malloc(TRACE_BUFFER * sizeof *trace.buffer);
+  if (!trace.buffer)
+    die("can not allocate trace buffer");
+  struct reti_trace_header header;
+  memcpy(header.magic, reti_trace_magic, sizeof header.magic);
+  header.record_size = sizeof(struct reti_trace_record);
+  header.instruction_length = instruction_length;
+  if (fwrite(&header, sizeof header, 1, trace.file) != 1)
+    die("can not write trace file '%s'", trace.path);
+  atexit(close_trace);
+}
 
-    unsigned PC_next = PC + 1; // Default is to increase PC.
-    bool D_write = false;      // Default is not to write to register D.
-    bool M_write = false;      // Default is not to write to memory.
-    bool M_read = false;       // Default is not to read from memory.
-    unsigned result = 0;       // Computed, loaded, or stored result.
-    unsigned address = 0;      // Address to read from or write to memory.
-    unsigned loaded;           // Loaded from memory.
-    bool taken = false;
-    char *comparison = 0;
+// The steps and the 'PC' range in which steps are printed or traced (see
+// '--trace-from', '--trace-to' and '--trace-pc').  The emulation runs fast
+// outside of the steps range (see 'emulate_stepping').
+
+static size_t trace_from = 1, trace_to = ~(size_t)0;
+static unsigned trace_lo = 0, trace_hi = ~0u;
+
+// The flight recorder keeps the last records of the emulation in a ring
+// buffer, which is printed in the format of '--step' to '<stderr>' if the
+// emulation stops abnormally (on errors, at undefined code, reaching the
+// steps limit or reading uninitialized data with '-g') or on 'SIGUSR1'.
+// The exact engine records all its steps, while the fast engine only
+// records the 'PC' when entering a basic block, which is cheap enough to
+// keep the recorder always on.  Compiled code ('--jit') is not recorded
+// though, only the steps executed by the exact engine in between.
+//
+// The 'SIGUSR1' handler only sets 'requested', which is polled by the
+// emulation loop and the fast engine when entering a basic block, such
+// that the ring is printed by the emulation itself (compiled code only
+// polls it when handing over to the exact engine).
+
+#define RECORDER 256 // Default number of records printed.
+
+static struct {
+  size_t size;                    // Records printed (zero if disabled).
+  size_t mask;                    // Capacity of 'ring' (above 'size') - 1.
+  size_t recorded;                // Records written so far.
+  struct reti_trace_record *ring; // Last 'mask + 1' records.
+  const unsigned *code;           // Code words of recorded blocks.
+  size_t size_code;               // Instructions of 'code'.
+  volatile sig_atomic_t requested; // Print on 'SIGUSR1'.
+} recorder = {RECORDER, 0, 0, 0, 0, 0, 0};
+
+// In stepping mode ('--step') the emulation only pushes the raw records of
+// the steps to a lock-free single-producer single-consumer queue.  A
+// separate printer thread formats them and writes them in large blocks.
+// Warnings are pushed to the same queue and printed by the printer in
+// order.  Before anything else is printed the emulation has to wait until
+// all pushed steps are written ('drain_steps').
+
+#define STEPS_QUEUE (1u << 14) // Records queued (a power of two).
+#define STEPS_BLOCK (1u << 16) // Bytes written at once.
+
+struct queued_step {
+  struct reti_trace_record record;
+  char *message; // Printed to '<stderr>' instead (if not zero).
+};
 
-    unsigned *M = reti.data; // Also used couple of times.
+static struct {
+  struct queued_step queued[STEPS_QUEUE];
+  _Alignas(64) atomic_size_t pushed; // Only incremented by the emulation.
+  _Alignas(64) atomic_size_t popped; // Only incremented by the printer.
+  atomic_size_t written;             // Popped and written to '<stdout>'.
+  atomic_bool idle;                  // Printer waits for 'pushing'.
+  atomic_bool draining;              // Emulation waits for 'drained'.
+  atomic_bool stop;                  // No more steps are pushed.
+  size_t free;                       // Known free records (emulation).
+  pthread_mutex_t lock;              // Only used for waiting.
+  pthread_cond_t pushing, drained;
+  pthread_t printer;
+  bool started;
+} steps_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .pushing = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+};
 
-#ifndef NSTEPPING
+// The queue itself is lock-free.  Only if the printer runs out of steps or
+// the emulation waits for the printer to write all steps the waiting thread
+// sleeps on a condition variable.  Setting 'idle' (or 'draining') before
+// checking the queue again and the other thread checking the flag after
+// updating the queue (all sequentially consistent) makes sure that it is
+// always woken up.
+
+static void wake_up(pthread_cond_t *condition) {
+  pthread_mutex_lock(&steps_queue.lock);
+  pthread_cond_signal(condition);
+  pthread_mutex_unlock(&steps_queue.lock);
+}
 
-    // Just make sure to have a valid string (with terminating zero).
+static void write_steps(const char *block, size_t size) {
+  fwrite(block, size, 1, stdout);
+  fflush(stdout);
+}
 
-    instruction[0] = action[0] = 0;
+static void *print_steps(void *dummy) {
+  (void)dummy;
+  static char block[STEPS_BLOCK];
+  size_t size = 0, popped = 0;
+  bool printed = false; // The header unless starting at the first step.
+  for (;;) {
+    const size_t pushed = atomic_load(&steps_queue.pushed);
+    if (popped == pushed) {
+      if (size)
+        write_steps(block, size), size = 0;
+      atomic_store(&steps_queue.written, popped);
+      if (atomic_load(&steps_queue.draining))
+        wake_up(&steps_queue.drained);
+      if (atomic_load(&steps_queue.stop) &&
+          popped == atomic_load(&steps_queue.pushed))
+        return 0;
+      pthread_mutex_lock(&steps_queue.lock);
+      atomic_store(&steps_queue.idle, true);
+      while (popped == atomic_load(&steps_queue.pushed) &&
+             !atomic_load(&steps_queue.stop))
+        pthread_cond_wait(&steps_queue.pushing, &steps_queue.lock);
+      atomic_store(&steps_queue.idle, false);
+      pthread_mutex_unlock(&steps_queue.lock);
+      continue;
+    }
+    while (popped != pushed) {
+      const struct queued_step *queued =
+          steps_queue.queued + (popped & (STEPS_QUEUE - 1));
+      const struct reti_trace_record *record = &queued->record;
+      if (queued->message) {
+        if (size)
+          write_steps(block, size), size = 0;
+        fputs(queued->message, stderr);
+        free(queued->message);
+      } else {
+        if (size + 2 * formatted_reti_trace_length > STEPS_BLOCK)
+          write_steps(block, size), size = 0;
+        if (!printed && record->steps != 1 && record->kind == RETI_TRACE_STEP)
+          size += format_reti_trace_header(instruction_length, block + size);
+        printed = true;
+        size += format_reti_trace(record, instruction_length, block + size);
+      }
+      if (!(++popped & 255))
+        atomic_store_explicit(&steps_queue.popped, popped,
+                              memory_order_release);
+    }
+    atomic_store_explicit(&steps_queue.popped, popped, memory_order_release);
+  }
+}
+
+// If the queue is full the printer is busy and thus yielding suffices.
+
+static void push_step(const struct reti_trace_record *record, char *message) {
+  const size_t pushed =
+      atomic_load_explicit(&steps_queue.pushed, memory_order_relaxed);
+  while (!steps_queue.free) {
+    const size_t popped =
+        atomic_load_explicit(&steps_queue.popped, memory_order_acquire);
+    steps_queue.free = STEPS_QUEUE - (pushed - popped);
+    if (!steps_queue.free)
+      sched_yield();
+  }
+  steps_queue.free--;
+  struct queued_step *queued =
+      steps_queue.queued + (pushed & (STEPS_QUEUE - 1));
+  if (record)
+    queued->record = *record;
+  queued->message = message;
+  atomic_store(&steps_queue.pushed, pushed + 1);
+  if (atomic_load(&steps_queue.idle))
+    wake_up(&steps_queue.pushing);
+}
+
+static bool queue_warning(const char *fmt, va_list ap) {
+  if (!steps_queue.started)
+    return false;
+  static const char prefix[] = "emreti: warning: ";
+  const size_t length = sizeof prefix - 1;
+  va_list copy;
+  va_copy(copy, ap);
+  const int printed = vsnprintf(0, 0, fmt, copy);
+  va_end(copy);
+  char *message = printed < 0 ? 0 : malloc(length + printed + 2);
+  if (!message)
+    return false;
+  memcpy(message, prefix, length);
+  vsnprintf(message + length, printed + 1, fmt, ap);
+  message[length + printed] = '\n';
+  message[length + printed + 1] = 0;
+  push_step(0, message);
+  return true;
+}
+
+static void drain_steps(void) {
+  if (!steps_queue.started)
+    return;
+  const size_t pushed =
+      atomic_load_explicit(&steps_queue.pushed, memory_order_relaxed);
+  if (atomic_load(&steps_queue.written) == pushed)
+    return;
+  pthread_mutex_lock(&steps_queue.lock);
+  atomic_store(&steps_queue.draining, true);
+  while (atomic_load(&steps_queue.written) != pushed)
+    pthread_cond_wait(&steps_queue.drained, &steps_queue.lock);
+  atomic_store(&steps_queue.draining, false);
+  pthread_mutex_unlock(&steps_queue.lock);
+}
+
+static void start_printer(void) {
+  if (pthread_create(&steps_queue.printer, 0, print_steps, 0))
+    die("can not start printer thread");
+  steps_queue.started = true;
+}
+
+static void stop_printer(void) {
+  if (!steps_queue.started)
+    return;
+  atomic_store(&steps_queue.stop, true);
+  wake_up(&steps_queue.pushing);
+  pthread_join(steps_queue.printer, 0);
+  steps_queue.started = false;
+}
+
+static inline void record_flight(const struct reti_trace_record *record) {
+  recorder.ring[recorder.recorded++ & recorder.mask] = *record;
+}
+
+// Print the last recorded records oldest first as in stepping mode.
+
+static void dump_recorder(void) {
+  const size_t recorded = recorder.recorded;
+  if (!recorder.size || !recorded)
+    return;
+  const size_t size = recorder.size < recorded ? recorder.size : recorded;
+  const size_t first = recorded - size;
+  fprintf(stderr, "emreti: recorder: last %zu records from step %" PRIu64 "\n",
+          size, recorder.ring[first & recorder.mask].steps);
+  char line[formatted_reti_trace_length];
+  for (size_t i = first; i != recorded; i++) {
+    struct reti_trace_record record = recorder.ring[i & recorder.mask];
+    if (record.kind == RETI_TRACE_BLOCK)
+      record.code = recorder.code[record.PC];
+    if (i == first && record.steps != 1 && record.kind != RETI_TRACE_LOOP &&
+        record.kind != RETI_TRACE_UNDEFINED) {
+      format_reti_trace_header(instruction_length, line);
+      fputs(line, stderr);
+    }
+    format_reti_trace(&record, instruction_length, line);
+    fputs(line, stderr);
+  }
+}
+
+static void request_recorder(int sig) {
+  (void)sig;
+  recorder.requested = 1;
+}
+
+static void dump_requested_recorder(void) {
+  recorder.requested = 0;
+  dump_recorder();
+}
+
+static void start_recording(void) {
+  if (!recorder.size)
+    return;
+  struct sigaction action;
+  memset(&action, 0, sizeof action);
+  action.sa_handler = request_recorder;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGUSR1, &action, 0))
+    die("can not install recorder signal handler");
+}
+
+// Each step of the exact engine in stepping mode ends up here, to be
+// printed immediately ('--step') and/or appended to the trace ('--trace'),
+// and all its steps are kept by the flight recorder (if enabled).
+
+static void record_step(uint64_t steps, enum reti_trace_kind kind,
+                        unsigned PC, unsigned I, const struct reti *reti,
+                        unsigned ACC, unsigned address, unsigned loaded) {
+  const struct reti_trace_record record = {
+      steps, kind, PC, I, reti->IN1, reti->IN2, ACC, address, loaded,
+  };
+  if (recorder.size)
+    record_flight(&record);
+  if (PC < trace_lo || PC > trace_hi)
+    return;
+  if (trace.file) {
+    if (trace.size == TRACE_BUFFER && !flush_trace())
+      die("can not write trace file '%s'", trace.path);
+    trace.buffer[trace.size++] = record;
+  }
+  if (step)
+    push_step(&record, 0);
+}
+
+// With '--profile=<file>' (or '--stats') the fast engine only counts how
+// often basic blocks are entered at each 'PC' (minus how often they are
+// left early at an instruction) and how often jumps are taken.  The number
+// of executions of every instruction is then summed up along its basic
+// block at the end (see 'count_executions').  The exact engine counts its
+// steps directly.
+
+struct counters {
+  int64_t entered; // Entered minus left early at this instruction.
+  uint64_t exact;  // Executed by the exact engine.
+  uint64_t taken;  // Jumps taken (by both engines).
+};
+
+static struct counters *counters; // One per instruction (or zero).
+
+// With '--sample=<hz>' a profiling timer interrupts the emulation and the
+// signal handler only reads this mirror of the 'PC' (see 'sample_PC').  It
+// is written if 'sampling' is set, by the exact engine at every step and by
+// the fast engine and compiled code whenever a basic block is entered.
+
+static volatile unsigned sampled_PC;
+static bool sampling;
+
+//----------------------------------------------------------------------------//
+
+// The exact engine executes exactly one instruction (or stops) and provides
+// all the checks, warnings and printing of the stepping mode.  It returns
+// 'false' if the emulation stops.
+//
+// It is always inlined into the emulation loops below with constant
+// 'stepping', 'debugging' and 'limited' arguments, which gives one copy of
+// the exact engine for each combination of options without the code and
+// checks not needed for that combination (see 'select_emulation').
+
+static inline __attribute__((always_inline)) bool
+execute_exactly(struct emulator *emulator, const bool stepping,
+                const int debugging, const bool limited) {
+
+  struct reti *reti = &emulator->reti;
+  struct shadow *shadow = &emulator->shadow;
+
+  if (emulator->steps++ == limit && limited) {
+    warn("steps limit '%zu' reached", limit);
+    dump_recorder();
+    return false;
+  }
+
+  const size_t steps = emulator->steps;
+  const unsigned PC = reti->PC;
+
+  if (PC >= shadow->code) {
+    if (stepping || recorder.size)
+      record_step(steps, RETI_TRACE_UNDEFINED, PC, 0, reti, reti->ACC, 0, 0);
+    if (PC != shadow->code) {
+      warn("stopping at undefined 'code[0x%08x]' above 0x%08x", PC,
+           (unsigned)(shadow->code - 1));
+      dump_recorder();
+    }
+    return false;
+  }
+
+  // Everything needed to execute the instruction is already decoded.
+
+  const struct decoded *decoded = reti->decoded + PC;
+  const unsigned immediate = decoded->immediate;
+  const unsigned D_code = decoded->destination;
+  const unsigned ACC = reti->ACC;
+
+  // In stepping mode each step is recorded before its effect.
+
+#define STEP()                                                                 \
+  do {                                                                         \
+    if (stepping || recorder.size)                                             \
+      record_step(steps, RETI_TRACE_STEP, PC, reti->code[PC], reti, ACC,       \
+                  address, loaded);                                            \
+    if (counters)                                                              \
+      counters[PC].exact++;                                                    \
+    if (sampling)                                                              \
+      sampled_PC = PC;                                                         \
+  } while (0)
+
+  // Only the destination register value 'result' has to be written.  If it
+  // is the 'PC' the next 'PC' becomes the written result.
+
+#define WRITE_REGISTER()                                                       \
+  do {                                                                         \
+    reti->R[D_code] = result;                                                  \
+    if (D_code == PC_CODE)                                                     \
+      PC_next = result;                                                        \
+  } while (0)
+
+  // Reading from memory requires to check that the address is valid.
+
+#define READ_MEMORY()                                                          \
+  do {                                                                         \
+    if (!valid_memory(M, address)) {                                           \
+      if (counters)                                                            \
+        emulator->uninitialized++;                                             \
+      if (debugging > 0) {                                                     \
+        warn("stopping on reading uninitialized 'data[0x%x]'", address);       \
+        dump_recorder();                                                       \
+        return false;                                                          \
+      }                                                                        \
+      if (!debugging)                                                          \
+        warn("continuing after reading uninitialized 'data[0x%x]' "            \
+             "(use '-i' so squelch such messages, or '-g' to stop)",           \
+             address);                                                         \
+    }                                                                          \
+  } while (0)
+
+#define WRITE_MEMORY()                                                         \
+  do {                                                                         \
+    write_memory(M, address, result);                                          \
+  } while (0)
+
+  // All jumps are the same after determining 'taken'.
+
+#define BRANCH()                                                               \
+  do {                                                                         \
+    if (taken)                                                                 \
+      PC_next = PC + immediate;                                                \
+    if (taken && counters)                                                     \
+      counters[PC].taken++;                                                    \
+    STEP();                                                                    \
+  } while (0)
+
+  unsigned PC_next = PC + 1; // Default is to increase PC.
+  unsigned result = 0;       // Computed, loaded, or stored result.
+  unsigned address = 0;      // Address to read from or write to memory.
+  unsigned loaded = 0;       // Loaded from memory.
+  unsigned D;                // Destination register before computing.
+  bool taken = false;
+
+  struct memory *M = &reti->data; // Also used couple of times.
+
+  switch (decoded->opcode) {
+
+    // Load Instructions
+
+  case LOAD: // LOAD D i
+    address = immediate;
+    result = loaded = read_memory(M, address);
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+  case LOADIN1: // LOADIN1 D i
+    address = reti->IN1 + immediate;
+    result = loaded = read_memory(M, address);
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+  case LOADIN2: // LOADIN2 D i
+    address = reti->IN2 + immediate;
+    result = loaded = read_memory(M, address);
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+  case LOADI: // LOADI D i
+    result = immediate;
+    STEP();
+    WRITE_REGISTER();
+    break;
+
+    // Store Instructions
+
+  case STORE: // STORE i
+    address = immediate;
+    result = ACC;
+    STEP();
+    WRITE_MEMORY();
+    break;
+  case STOREIN1: // STOREIN1 i
+    address = reti->IN1 + immediate;
+    result = ACC;
+    STEP();
+    WRITE_MEMORY();
+    break;
+  case STOREIN2: // STOREIN2 i
+    address = reti->IN2 + immediate;
+    result = ACC;
+    STEP();
+    WRITE_MEMORY();
+    break;
+  case MOVE: // MOVE S D
+    result = reti->R[decoded->source];
+    STEP();
+    WRITE_REGISTER();
+    break;
+
+    // Compute Instructions
+
+  case SUBI: // SUBI D i
+    D = reti->R[D_code];
+    result = D - immediate;
+    STEP();
+    WRITE_REGISTER();
+    break;
+  case ADDI: // ADDI D i
+    D = reti->R[D_code];
+    result = D + immediate;
+    STEP();
+    WRITE_REGISTER();
+    break;
+  case OPLUSI: // OPLUSI D i
+    D = reti->R[D_code];
+    result = D ^ immediate;
+    STEP();
+    WRITE_REGISTER();
+    break;
+  case ORI: // ORI D i
+    D = reti->R[D_code];
+    result = D | immediate;
+    STEP();
+    WRITE_REGISTER();
+    break;
+  case ANDI: // ANDI D i
+    D = reti->R[D_code];
+    result = D & immediate;
+    STEP();
+    WRITE_REGISTER();
+    break;
+  case SUB: // SUB D i
+    D = reti->R[D_code];
+    address = immediate;
+    loaded = read_memory(M, address);
+    result = D - loaded;
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+  case ADD: // ADD D i
+    D = reti->R[D_code];
+    address = immediate;
+    loaded = read_memory(M, address);
+    result = D + loaded;
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+  case OPLUS: // OPLUS D i
+    D = reti->R[D_code];
+    address = immediate;
+    loaded = read_memory(M, address);
+    result = D ^ loaded;
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+  case OR: // OR D i
+    D = reti->R[D_code];
+    address = immediate;
+    loaded = read_memory(M, address);
+    result = D | loaded;
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+  case AND: // AND D i
+    D = reti->R[D_code];
+    address = immediate;
+    loaded = read_memory(M, address);
+    result = D & loaded;
+    STEP();
+    READ_MEMORY();
+    WRITE_REGISTER();
+    break;
+
+    // Jump Instructions
+
+  case NOP: // NOP
+    BRANCH();
+    break;
+  case JUMPGT: // JUMP> i
+    taken = ((int)ACC > 0);
+    BRANCH();
+    break;
+  case JUMPEQ: // JUMP= i
+    taken = ((int)ACC == 0);
+    BRANCH();
+    break;
+  case JUMPGE: // JUMP>= i
+    taken = ((int)ACC >= 0);
+    BRANCH();
+    break;
+  case JUMPLT: // JUMP< i
+    taken = ((int)ACC < 0);
+    BRANCH();
+    break;
+  case JUMPNE: // JUMP!= i
+    taken = ((int)ACC != 0);
+    BRANCH();
+    break;
+  case JUMPLE: // JUMP<= i
+    taken = ((int)ACC <= 0);
+    BRANCH();
+    break;
+  case JUMP: // JUMP i
+    taken = true;
+    BRANCH();
+    break;
+
+  default:
+    assert(decoded->opcode == ILLEGAL);
+    die("illegal instruction '0x%08x' at 'code[0x%08x]'", reti->code[PC], PC);
+    break;
+  }
+
+  if (PC_next == PC) { // Check if stuck in infinite loop.
+    if (stepping || recorder.size)
+      record_step(steps, RETI_TRACE_LOOP, PC, reti->code[PC], reti, ACC, 0, 0);
+    return false;
+  }
+
+  // Finally update PC.
+
+  reti->PC = PC_next;
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+// Whether the jump with the given 'opcode' is taken for this 'ACC' value.
+
+static bool jumps(unsigned opcode, unsigned ACC) {
+  const int value = ACC;
+  switch (opcode) {
+  case JUMPGT:
+    return value > 0;
+  case JUMPEQ:
+    return value == 0;
+  case JUMPGE:
+    return value >= 0;
+  case JUMPLT:
+    return value < 0;
+  case JUMPNE:
+    return value != 0;
+  case JUMPLE:
+    return value <= 0;
+  default:
+    assert(opcode == JUMP);
+    return true;
+  }
+}
+
+// After one iteration of a counting loop (see 'fuse_code') this function
+// determines how many more iterations the loop takes, where 'ACC' is the
+// current value of the accumulator tested by the 'opcode' of the jump at the
+// end of the loop and 'delta' is added to 'ACC' in every iteration.  The
+// result is 'SIZE_MAX' if the loop never terminates.  Since 'ACC' is
+// compared as signed number, it can only wrap around once before the loop
+// exits, except for the 'JUMP!=' case, which requires solving the linear
+// congruence 'ACC + iterations * delta == 0' modulo '2^32'.
+
+static size_t count_iterations(unsigned opcode, unsigned ACC, unsigned delta) {
+  if (!jumps(opcode, ACC))
+    return 0;
+  if (opcode == JUMP || !delta)
+    return SIZE_MAX;
+  if (!jumps(opcode, ACC + delta))
+    return 1;
+  const int64_t value = (int)ACC, step = (int)delta;
+  switch (opcode) {
+  case JUMPGT:
+    if (step < 0)
+      return (value - step - 1) / -step;
+    return (INT32_MAX - value) / step + 1;
+  case JUMPGE:
+    if (step < 0)
+      return value / -step + 1;
+    return (INT32_MAX - value) / step + 1;
+  case JUMPLT:
+    if (step > 0)
+      return (step - value - 1) / step;
+    return (value - INT32_MIN) / -step + 1;
+  case JUMPLE:
+    if (step == INT32_MIN)
+      return SIZE_MAX; // Alternates between 'INT32_MIN' and zero.
+    if (step > 0)
+      return -value / step + 1;
+    return (value - INT32_MIN) / -step + 1;
+  default: {
+    assert(opcode == JUMPNE); // 'JUMP=' already returned above.
+    const unsigned shift = __builtin_ctz(delta);
+    if (ACC & ((1u << shift) - 1))
+      return SIZE_MAX;
+    const unsigned odd = delta >> shift;
+    unsigned inverse = odd; // Inverse modulo '2^3' and by Newton
+    for (int i = 0; i != 4; i++) // iteration modulo '2^6', ..., '2^48'.
+      inverse *= 2 - odd * inverse;
+    return ((-ACC >> shift) * inverse) & (~0u >> shift);
+  }
+  }
+}
+
+// Fill 'count' words starting at 'address' in 'direction' (one or minus
+// one) with 'value', which is incremented by 'delta' after each word, as a
+// fill loop (see 'memory_loop') does.  If more words are written than the
+// address space has, only the last writes to each address matter.
+
+static void fill_memory(struct memory *memory, unsigned address,
+                        unsigned direction, size_t count, unsigned value,
+                        unsigned delta) {
+  if (count > CAPACITY) {
+    const size_t skipped = count - CAPACITY;
+    address += (unsigned)skipped * direction;
+    value += (unsigned)skipped * delta;
+    count = CAPACITY;
+  }
+  while (count) {
+    struct page *page = get_page(memory, address);
+    const size_t word = WORD_INDEX(address);
+    size_t words = direction == 1 ? PAGE_SIZE - word : word + 1;
+    if (words > count)
+      words = count;
+    unsigned *p = page->words + word;
+    if (direction == 1) {
+      for (size_t i = 0; i != words; i++, value += delta)
+        p[i] = value;
+      validate_words(page, word, words);
+    } else {
+      for (size_t i = 0; i != words; i++, value += delta)
+        *p-- = value;
+      validate_words(page, word + 1 - words, words);
+    }
+    address += (unsigned)words * direction;
+    count -= words;
+  }
+}
+
+// Copy at most 'count' words from 'source' to 'target' in 'direction' as a
+// copy loop (see 'memory_loop') with a jump given by 'opcode' does.  The
+// copy stops after the first word for which the jump is not taken and
+// before reading an invalid word.  The last copied word is saved in 'last'
+// and the number of copied words returned.  Within one page the words are
+// copied with 'memmove', unless the copy would overwrite words it still
+// has to read.  Then the words up to the first overwritten one are copied
+// first, such that reads see the previous writes as in the loop.
+
+static size_t copy_memory(struct memory *memory, unsigned source,
+                          unsigned target, unsigned direction, size_t count,
+                          unsigned opcode, unsigned *last) {
+  size_t res = 0;
+  while (res != count) {
+    const struct page *from = load_page(memory, source);
+    const size_t i = WORD_INDEX(source), j = WORD_INDEX(target);
+    if (!from || !valid_word(from, i))
+      break;
+    struct page *to = get_page(memory, target);
+    size_t words = direction == 1 ? PAGE_SIZE - (i < j ? j : i)
+                                  : (i < j ? i : j) + 1;
+    if (words > count - res)
+      words = count - res;
+    if (from == to) {
+      const size_t ahead = direction == 1 ? j - i : i - j;
+      if (ahead && ahead < words)
+        words = ahead;
+    }
+    size_t copied = 0;
+    bool exits = false;
+    while (!exits && copied != words) {
+      const size_t word = direction == 1 ? i + copied : i - copied;
+      if (!valid_word(from, word))
+        break;
+      *last = from->words[word];
+      exits = !jumps(opcode, *last);
+      copied++;
+    }
+    const size_t first = direction == 1 ? i : i + 1 - copied;
+    const size_t second = direction == 1 ? j : j + 1 - copied;
+    memmove(to->words + second, from->words + first,
+            copied * sizeof *to->words);
+    validate_words(to, second, copied);
+    res += copied;
+    if (exits || copied != words)
+      break;
+    source += (unsigned)copied * direction;
+    target += (unsigned)copied * direction;
+  }
+  return res;
+}
+
+// The fast engine executes whole basic blocks (see 'struct decoded').  The
+// steps limit and the 'PC' is only checked when entering a basic block and
+// the steps of the whole block are accounted for at once.  Whenever anything
+// unusual happens, i.e., the remaining steps do not suffice for the block,
+// the next 'PC' is out of the program code, reading uninitialized data,
+// self-loops and instructions which have 'EXACT' as 'fast_opcode', the
+// fast engine returns without executing the current instruction and leaves
+// it to the exact engine.
+//
+// For threaded dispatch the handler addresses of the decoded instructions
+// are set by calling this function with a zero 'emulator' once.
+
+static void execute_fast(struct emulator *emulator, struct decoded *decoded,
+                         size_t size) {
+
+#ifdef THREADED
+
+#define HANDLER(OPCODE)                                                        \
+  case OPCODE:                                                                 \
+  OPCODE##_HANDLER:
+
+#define DISPATCH() goto *decoded->handler
+
+  static const void *const handlers[] = {
+#define OPCODE(NAME, ...) [NAME] = &&NAME##_HANDLER,
+      RETI_OPCODES
+#undef OPCODE
+      [EXACT] = &&EXACT_HANDLER,
+
+      [ADDI_JUMPGT] = &&ADDI_JUMPGT_HANDLER,
+      [ADDI_JUMPEQ] = &&ADDI_JUMPEQ_HANDLER,
+      [ADDI_JUMPGE] = &&ADDI_JUMPGE_HANDLER,
+      [ADDI_JUMPLT] = &&ADDI_JUMPLT_HANDLER,
+      [ADDI_JUMPNE] = &&ADDI_JUMPNE_HANDLER,
+      [ADDI_JUMPLE] = &&ADDI_JUMPLE_HANDLER,
+      [SUBI_JUMPGT] = &&SUBI_JUMPGT_HANDLER,
+      [SUBI_JUMPEQ] = &&SUBI_JUMPEQ_HANDLER,
+      [SUBI_JUMPGE] = &&SUBI_JUMPGE_HANDLER,
+      [SUBI_JUMPLT] = &&SUBI_JUMPLT_HANDLER,
+      [SUBI_JUMPNE] = &&SUBI_JUMPNE_HANDLER,
+      [SUBI_JUMPLE] = &&SUBI_JUMPLE_HANDLER,
+      [ADDI_LOADIN] = &&ADDI_LOADIN_HANDLER,
+      [ADDI_STOREIN] = &&ADDI_STOREIN_HANDLER,
+      [LOAD_ADDI_STORE] = &&LOAD_ADDI_STORE_HANDLER,
+      [LOAD_SUBI_STORE] = &&LOAD_SUBI_STORE_HANDLER,
+      [COUNT_LOOP] = &&COUNT_LOOP_HANDLER,
+      [FILL_LOOP] = &&FILL_LOOP_HANDLER,
+      [COPY_LOOP] = &&COPY_LOOP_HANDLER,
+  };
+
+  if (!emulator) {
+    for (size_t i = 0; i <= size; i++)
+      decoded[i].handler = handlers[decoded[i].fast_opcode];
+    return;
+  }
+
+#else
+
+#define HANDLER(OPCODE) case OPCODE:
+#define DISPATCH() goto SWITCH
+
+  if (!emulator)
+    return;
+
+#endif
+
+  (void)size;
+
+  struct reti *reti = &emulator->reti;
+  struct shadow *shadow = &emulator->shadow;
+  struct decoded *const code = reti->decoded;
+  struct memory *const M = &reti->data;
+  const size_t instructions = shadow->code;
+  struct counters *const counted = counters;
+  volatile unsigned *const mirror = sampling ? &sampled_PC : 0;
+  struct reti_trace_record *const ring = recorder.size ? recorder.ring : 0;
+  const size_t mask = recorder.mask;
+  size_t recorded = recorder.recorded;
+
+  // Keeping registers and steps in local variables allows the compiler to
+  // keep them in host registers (memory writes can not alias them).
+
+  unsigned R[4] = {0, reti->IN1, reti->IN2, reti->ACC};
+  size_t steps = emulator->steps;
+  unsigned PC = reti->PC, PC_next, address, loaded;
+  const struct page *page;
+
+  // Reading uninitialized data is left to the exact engine which produces
+  // warnings or stops, unless such reads are ignored, in which case zero
+  // is read from invalid words as well as from missing pages.  The option
+  // is copied into a local constant to keep it in a host register.  Only
+  // if counting (see 'counters') ignored reads are still checked.
+
+  const bool ignoring = debug < 0;
+  const bool unchecked = ignoring && !counted;
+
+#define LOAD_WORD(ADDRESS)                                                     \
+  do {                                                                         \
+    address = (ADDRESS);                                                       \
+    page = load_page(M, address);                                              \
+    if (page && (unchecked || valid_word(page, WORD_INDEX(address))))          \
+      loaded = page->words[WORD_INDEX(address)];                               \
+    else if (ignoring) {                                                       \
+      loaded = page ? page->words[WORD_INDEX(address)] : 0;                    \
+      if (counted)                                                             \
+        emulator->uninitialized++;                                             \
+    } else                                                                     \
+      goto EXIT_CURRENT;                                                       \
+  } while (0)
+
+#define LOAD_REGISTER(ADDRESS)                                                 \
+  do {                                                                         \
+    LOAD_WORD(ADDRESS);                                                        \
+    R[decoded->destination] = loaded;                                          \
+  } while (0)
+
+#define STORE_ACC(ADDRESS)                                                     \
+  do {                                                                         \
+    write_memory(M, (ADDRESS), R[ACC_CODE]);                                   \
+  } while (0)
+
+#define COMPUTE(OPERATOR, OPERAND)                                             \
+  do {                                                                         \
+    R[decoded->destination] OPERATOR## = (OPERAND);                            \
+  } while (0)
+
+#define COMPUTE_MEMORY(OPERATOR)                                               \
+  do {                                                                         \
+    LOAD_WORD(decoded->immediate);                                             \
+    COMPUTE(OPERATOR, loaded);                                                 \
+  } while (0)
+
+  // Continue with the next instruction in the same basic block.
+
+#define NEXT()                                                                 \
+  do {                                                                         \
+    decoded++;                                                                 \
+    DISPATCH();                                                                \
+  } while (0)
+
+  // Conditional and unconditional jumps end basic blocks.
+
+#define JUMP_IF(CONDITION)                                                     \
+  do {                                                                         \
+    PC = decoded - code;                                                       \
+    if (CONDITION) {                                                           \
+      PC_next = PC + decoded->immediate;                                       \
+      if (PC_next == PC)                                                       \
+        goto EXIT_CURRENT;                                                     \
+      if (counted)                                                             \
+        counted[PC].taken++;                                                   \
+      PC = PC_next;                                                            \
+    } else                                                                     \
+      PC++;                                                                    \
+    goto ENTER;                                                                \
+  } while (0)
+
+  // Fused instructions (see 'fuse_code') move on to the next instruction of
+  // the sequence with 'decoded++' before executing it, such that exiting at
+  // it leaves the exact engine the right instruction and steps.
+
+#define COMPUTE_JUMP_IF(OPERATOR, CONDITION)                                   \
+  do {                                                                         \
+    R[ACC_CODE] OPERATOR## = decoded->immediate;                               \
+    decoded++;                                                                 \
+    JUMP_IF(CONDITION);                                                        \
+  } while (0)
+
+#define LOAD_COMPUTE_STORE(OPERATOR)                                           \
+  do {                                                                         \
+    LOAD_WORD(decoded->immediate);                                             \
+    decoded++;                                                                 \
+    R[ACC_CODE] = loaded OPERATOR decoded->immediate;                          \
+    decoded++;                                                                 \
+    STORE_ACC(decoded->immediate);                                             \
+  } while (0)
+
+ENTER:
+
+  // Enter the basic block at 'PC' if it is valid and its steps fit.
+
+  if (PC >= instructions)
+    goto EXIT;
+  decoded = code + PC;
+  if (decoded->length > limit - steps)
+    goto EXIT;
+  // The flight recorder only keeps the 'PC' when entering a block (as
+  // 'record_flight' but with the ring buffer and the number of records kept
+  // in host registers, while the latter is still stored for 'die').
+
+  if (ring) {
+    if (recorder.requested)
+      goto EXIT;
+    struct reti_trace_record *record = ring + (recorded & mask);
+    record->steps = steps + 1;
+    record->kind = RETI_TRACE_BLOCK;
+    record->PC = PC;
+    recorder.recorded = ++recorded;
+  }
+  steps += decoded->length;
+  if (counted)
+    counted[PC].entered++;
+  if (mirror)
+    *mirror = PC;
+
+#ifdef THREADED
+  DISPATCH();
+#else
+SWITCH:
+#endif
+
+  switch (decoded->fast_opcode) {
+
+    HANDLER(LOAD) { // LOAD D i
+      LOAD_REGISTER(decoded->immediate);
+      NEXT();
+    }
+    HANDLER(LOADIN1) { // LOADIN1 D i
+      LOAD_REGISTER(R[IN1_CODE] + decoded->immediate);
+      NEXT();
+    }
+    HANDLER(LOADIN2) { // LOADIN2 D i
+      LOAD_REGISTER(R[IN2_CODE] + decoded->immediate);
+      NEXT();
+    }
+    HANDLER(LOADI) { // LOADI D i
+      R[decoded->destination] = decoded->immediate;
+      NEXT();
+    }
+
+    HANDLER(STORE) { // STORE i
+      STORE_ACC(decoded->immediate);
+      NEXT();
+    }
+    HANDLER(STOREIN1) { // STOREIN1 i
+      STORE_ACC(R[IN1_CODE] + decoded->immediate);
+      NEXT();
+    }
+    HANDLER(STOREIN2) { // STOREIN2 i
+      STORE_ACC(R[IN2_CODE] + decoded->immediate);
+      NEXT();
+    }
+    HANDLER(MOVE) { // MOVE S D
+      R[decoded->destination] = R[decoded->source];
+      NEXT();
+    }
+
+    HANDLER(SUBI) { // SUBI D i
+      COMPUTE(-, decoded->immediate);
+      NEXT();
+    }
+    HANDLER(ADDI) { // ADDI D i
+      COMPUTE(+, decoded->immediate);
+      NEXT();
+    }
+    HANDLER(OPLUSI) { // OPLUSI D i
+      COMPUTE(^, decoded->immediate);
+      NEXT();
+    }
+    HANDLER(ORI) { // ORI D i
+      COMPUTE(|, decoded->immediate);
+      NEXT();
+    }
+    HANDLER(ANDI) { // ANDI D i
+      COMPUTE(&, decoded->immediate);
+      NEXT();
+    }
+    HANDLER(SUB) { // SUB D i
+      COMPUTE_MEMORY(-);
+      NEXT();
+    }
+    HANDLER(ADD) { // ADD D i
+      COMPUTE_MEMORY(+);
+      NEXT();
+    }
+    HANDLER(OPLUS) { // OPLUS D i
+      COMPUTE_MEMORY(^);
+      NEXT();
+    }
+    HANDLER(OR) { // OR D i
+      COMPUTE_MEMORY(|);
+      NEXT();
+    }
+    HANDLER(AND) { // AND D i
+      COMPUTE_MEMORY(&);
+      NEXT();
+    }
+
+    HANDLER(NOP) { // NOP
+      NEXT();
+    }
+    HANDLER(JUMPGT) { // JUMP> i
+      JUMP_IF((int)R[ACC_CODE] > 0);
+    }
+    HANDLER(JUMPEQ) { // JUMP= i
+      JUMP_IF((int)R[ACC_CODE] == 0);
+    }
+    HANDLER(JUMPGE) { // JUMP>= i
+      JUMP_IF((int)R[ACC_CODE] >= 0);
+    }
+    HANDLER(JUMPLT) { // JUMP< i
+      JUMP_IF((int)R[ACC_CODE] < 0);
+    }
+    HANDLER(JUMPNE) { // JUMP!= i
+      JUMP_IF((int)R[ACC_CODE] != 0);
+    }
+    HANDLER(JUMPLE) { // JUMP<= i
+      JUMP_IF((int)R[ACC_CODE] <= 0);
+    }
+    HANDLER(JUMP) { // JUMP i
+      JUMP_IF(true);
+    }
+
+    HANDLER(EXACT) { goto EXIT_CURRENT; }
+
+    HANDLER(ADDI_JUMPGT) { // ADDI ACC i + JUMP> j
+      COMPUTE_JUMP_IF(+, (int)R[ACC_CODE] > 0);
+    }
+    HANDLER(ADDI_JUMPEQ) { // ADDI ACC i + JUMP= j
+      COMPUTE_JUMP_IF(+, (int)R[ACC_CODE] == 0);
+    }
+    HANDLER(ADDI_JUMPGE) { // ADDI ACC i + JUMP>= j
+      COMPUTE_JUMP_IF(+, (int)R[ACC_CODE] >= 0);
+    }
+    HANDLER(ADDI_JUMPLT) { // ADDI ACC i + JUMP< j
+      COMPUTE_JUMP_IF(+, (int)R[ACC_CODE] < 0);
+    }
+    HANDLER(ADDI_JUMPNE) { // ADDI ACC i + JUMP!= j
+      COMPUTE_JUMP_IF(+, (int)R[ACC_CODE] != 0);
+    }
+    HANDLER(ADDI_JUMPLE) { // ADDI ACC i + JUMP<= j
+      COMPUTE_JUMP_IF(+, (int)R[ACC_CODE] <= 0);
+    }
+    HANDLER(SUBI_JUMPGT) { // SUBI ACC i + JUMP> j
+      COMPUTE_JUMP_IF(-, (int)R[ACC_CODE] > 0);
+    }
+    HANDLER(SUBI_JUMPEQ) { // SUBI ACC i + JUMP= j
+      COMPUTE_JUMP_IF(-, (int)R[ACC_CODE] == 0);
+    }
+    HANDLER(SUBI_JUMPGE) { // SUBI ACC i + JUMP>= j
+      COMPUTE_JUMP_IF(-, (int)R[ACC_CODE] >= 0);
+    }
+    HANDLER(SUBI_JUMPLT) { // SUBI ACC i + JUMP< j
+      COMPUTE_JUMP_IF(-, (int)R[ACC_CODE] < 0);
+    }
+    HANDLER(SUBI_JUMPNE) { // SUBI ACC i + JUMP!= j
+      COMPUTE_JUMP_IF(-, (int)R[ACC_CODE] != 0);
+    }
+    HANDLER(SUBI_JUMPLE) { // SUBI ACC i + JUMP<= j
+      COMPUTE_JUMP_IF(-, (int)R[ACC_CODE] <= 0);
+    }
+    HANDLER(ADDI_LOADIN) { // ADDI INx i + LOADINx D j
+      const unsigned base = R[decoded->destination] += decoded->immediate;
+      decoded++;
+      LOAD_REGISTER(base + decoded->immediate);
+      NEXT();
+    }
+    HANDLER(ADDI_STOREIN) { // ADDI INx i + STOREINx j
+      const unsigned base = R[decoded->destination] += decoded->immediate;
+      decoded++;
+      STORE_ACC(base + decoded->immediate);
+      NEXT();
+    }
+    HANDLER(LOAD_ADDI_STORE) { // LOAD ACC i + ADDI ACC j + STORE k
+      LOAD_COMPUTE_STORE(+);
+      NEXT();
+    }
+    HANDLER(LOAD_SUBI_STORE) { // LOAD ACC i + SUBI ACC j + STORE k
+      LOAD_COMPUTE_STORE(-);
+      NEXT();
+    }
+
+    // The steps of the first iteration of a counting loop are accounted for
+    // already.  After executing it, as many of the remaining iterations as
+    // the steps limit allows are added at once.  If the loop is cut short
+    // it is entered again, which leaves the rest to the exact engine.  For
+    // profiling each iteration enters the loop and all but a last exiting
+    // iteration take the jump back.
+
+    HANDLER(COUNT_LOOP) { // ADDI|SUBI|LOADI|NOP ... + JUMPcc back
+      const struct decoded *jump = decoded + decoded->length - 1;
+      unsigned delta[4] = {0, 0, 0, 0}, constant = 0;
+      for (const struct decoded *d = decoded; d != jump; d++) {
+        const unsigned D = d->destination;
+        if (d->opcode == LOADI) {
+          R[D] = d->immediate;
+          constant |= 1u << D;
+        } else if (d->opcode == ADDI) {
+          R[D] += d->immediate;
+          delta[D] += d->immediate;
+        } else if (d->opcode == SUBI) {
+          R[D] -= d->immediate;
+          delta[D] -= d->immediate;
+        }
+      }
+      for (unsigned D = IN1_CODE; D <= ACC_CODE; D++)
+        if (constant & (1u << D))
+          delta[D] = 0;
+      const size_t length = decoded->length;
+      const size_t remaining = (limit - steps) / length;
+      size_t iterations =
+          count_iterations(jump->opcode, R[ACC_CODE], delta[ACC_CODE]);
+      if (iterations > remaining) {
+        iterations = remaining;
+        PC = decoded - code;
+      } else
+        PC = jump - code + 1;
+      steps += iterations * length;
+      for (unsigned D = IN1_CODE; D <= ACC_CODE; D++)
+        R[D] += (unsigned)iterations * delta[D];
+      if (counted) {
+        counted[decoded - code].entered += iterations;
+        counted[jump - code].taken += iterations + (PC == decoded - code);
+      }
+      goto ENTER;
+    }
+
+    // Memory loops (see 'memory_loop') are handled in the same way, except
+    // that the first iteration is executed in bulk too.  If a copy loop
+    // can not copy a single word it is left to the exact engine.
+
+    HANDLER(FILL_LOOP) { // ... + STOREINx i + ... + JUMPcc back
+      const struct decoded *jump = decoded + decoded->length - 1;
+      struct loop loop;
+      memory_loop(decoded, jump, &loop);
+      const unsigned *delta = loop.delta;
+      const unsigned base = base_register(loop.store);
+      const size_t length = decoded->length;
+      const size_t remaining = (limit - steps) / length;
+      size_t iterations = count_iterations(
+          jump->opcode, R[ACC_CODE] + delta[ACC_CODE], delta[ACC_CODE]);
+      if (iterations > remaining) {
+        iterations = remaining;
+        PC = decoded - code;
+      } else
+        PC = jump - code + 1;
+      steps += iterations++ * length;
+      fill_memory(M, R[base] + loop.store_offset, delta[base], iterations,
+                  R[ACC_CODE] + loop.value_offset, delta[ACC_CODE]);
+      for (unsigned D = IN1_CODE; D <= ACC_CODE; D++)
+        R[D] += (unsigned)iterations * delta[D];
+      if (counted) {
+        counted[decoded - code].entered += iterations - 1;
+        counted[jump - code].taken += iterations - (PC != decoded - code);
+      }
+      goto ENTER;
+    }
+
+    HANDLER(COPY_LOOP) { // ... + LOADINx ACC i + ... + STOREINy j + ...
+      const struct decoded *jump = decoded + decoded->length - 1;
+      struct loop loop;
+      memory_loop(decoded, jump, &loop);
+      const unsigned *delta = loop.delta;
+      const unsigned source = R[base_register(loop.load)] + loop.load_offset;
+      const unsigned target = R[base_register(loop.store)] + loop.store_offset;
+      const unsigned direction = delta[base_register(loop.store)];
+      const size_t length = decoded->length;
+      const size_t count = (limit - steps) / length + 1;
+      unsigned last;
+      const size_t iterations = copy_memory(M, source, target, direction,
+                                            count, jump->opcode, &last);
+      if (!iterations)
+        goto EXIT_CURRENT;
+      steps += (iterations - 1) * length;
+      R[ACC_CODE] = last;
+      R[IN1_CODE] += (unsigned)iterations * delta[IN1_CODE];
+      R[IN2_CODE] += (unsigned)iterations * delta[IN2_CODE];
+      if (jumps(jump->opcode, last))
+        PC = decoded - code;
+      else
+        PC = jump - code + 1;
+      if (counted) {
+        counted[decoded - code].entered += iterations - 1;
+        counted[jump - code].taken += iterations - (PC != decoded - code);
+      }
+      goto ENTER;
+    }
+  }
+
+  // The current instruction has not been executed and thus its steps and
+  // those of the rest of its basic block are not accounted for.
+
+EXIT_CURRENT:
+  PC = decoded - code;
+  steps -= decoded->length;
+  if (counted)
+    counted[PC].entered--;
+
+  // Leaving at the first step of the block drops its record, since the
+  // exact engine records that step itself (or stops at it).
+
+  if (ring && ring[(recorded - 1) & mask].steps == steps + 1)
+    recorder.recorded = recorded - 1;
+
+EXIT:
+  reti->PC = PC;
+  reti->IN1 = R[IN1_CODE];
+  reti->IN2 = R[IN2_CODE];
+  reti->ACC = R[ACC_CODE];
+  emulator->steps = steps;
+}
+
+//----------------------------------------------------------------------------//
+
+#ifdef JIT
+
+// The just-in-time compiler translates the whole program once into x86-64
+// machine code.  It follows exactly the rules of the fast engine above.
+// Steps are accounted for when entering a basic block, which with direct
+// jumps only happens at statically known targets.  Thus every jump checks
+// the remaining steps against the 'length' of its target inline.  All the
+// unusual events handed over to the exact engine by the fast engine leave
+// the compiled code through an exit stub in a separate cold code area.
+//
+// During execution of compiled code the host registers are used as follows:
+//
+//   'rax'  address, then valid bits or words of page, or 'PC' on exit
+//   'rcx'  remaining steps until reaching the steps limit
+//   'rdx'  table and then page of memory access
+//   'rsi'  page tables of data memory 'reti.data'
+//   'rdi'  pointer to 'struct jit_state' (see below)
+//   'r8d'  'IN1'
+//   'r9d'  'IN2'
+//   'r10d' 'ACC'
+//   'r11'  index of table and then of word of memory access
+//
+// The 'PC' does not need a register, since it is implied by the position in
+// the compiled code, and is only set to the 'PC' of the exit stub on exit.
+
+enum {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R9 = 9,
+  R10 = 10,
+  R11 = 11,
+};
+
+// Maps register codes to host registers (the 'PC' is never mapped).
+
+static const unsigned char host_registers[4] = {RAX, R8, R9, R10};
+
+// Registers and memory are passed between C and compiled code through this.
+
+struct jit_state {
+  unsigned R[4];          // The 'PC' is only written on exit.
+  size_t remaining;       // Remaining steps after entering the first block.
+  struct memory *memory;  // Data memory 'reti.data'.
+  const void *entry;      // Compiled code of instruction at 'PC'.
+};
+
+// Upper bounds on the number of bytes generated per instruction in the hot
+// and cold code areas and for the entry and exit code.
+
+#define HOT_BYTES 128
+#define COLD_BYTES 96
+#define ENTRY_EXIT_BYTES 128
+
+// Larger programs are not compiled.
+
+#define MAX_JIT_SIZE ((size_t)1 << 23)
+
+struct jit {
+  unsigned char *buffer;             // Mapped executable code area.
+  size_t bytes;                      // Size of 'buffer'.
+  void (*call)(struct jit_state *);  // Entry code at the start of 'buffer'.
+  const unsigned char **compiled;    // Compiled code of each instruction.
+};
+
+static struct jit jit;
+static bool just_in_time; // Option '--jit'.
+
+// An unresolved 'rel32' displacement to the compiled code of a target.
+
+struct fixup {
+  unsigned char *at;
+  size_t target;
+};
+
+// The assembler state during compilation.
+
+struct assembler {
+  unsigned char *hot, *cold;   // Current end of hot and cold code area.
+  const unsigned char *exit;   // Common exit code.
+  const struct decoded *code;  // Decoded instructions.
+  size_t size;                 // Number of instructions.
+  bool image;                  // Missing pages might be in the data image.
+  struct fixup *fixups, *top;  // Unresolved jumps to compiled code.
+};
+
+//----------------------------------------------------------------------------//
+
+// Basic x86-64 instruction encoding.
+
+static void emit_byte(unsigned char **p, unsigned byte) { *(*p)++ = byte; }
+
+static void emit_word(unsigned char **p, unsigned word) {
+  memcpy(*p, &word, 4);
+  *p += 4;
+}
+
+// Set 'rel32' displacement at 'at' to jump to 'target'.
+
+static void patch(unsigned char *at, const unsigned char *target) {
+  const int rel32 = (int)(target - (at + 4));
+  memcpy(at, &rel32, 4);
+}
+
+// The REX prefix extends the 'reg' and 'r/m' fields of the ModRM byte and
+// selects 64-bit operands ('W').  It is only emitted if needed.
+
+static void emit_rex(unsigned char **p, bool W, unsigned reg, unsigned rm) {
+  const unsigned rex = 0x40 | (W << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40)
+    emit_byte(p, rex);
+}
+
+// Register to register and immediate to register instructions.
+
+static void emit_mov_immediate(unsigned char **p, unsigned reg, unsigned i) {
+  emit_rex(p, false, 0, reg);
+  emit_byte(p, 0xb8 + (reg & 7)); // mov r32, imm32
+  emit_word(p, i);
+}
+
+static void emit_mov_register(unsigned char **p, unsigned dst, unsigned src) {
+  emit_rex(p, false, src, dst);
+  emit_byte(p, 0x89); // mov r/m32, r32
+  emit_byte(p, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+// The 'extension' selects the operation of 'op r/m, imm32' (0x81).
+
+enum {
+  ADD_EXTENSION = 0,
+  OR_EXTENSION = 1,
+  AND_EXTENSION = 4,
+  SUB_EXTENSION = 5,
+  XOR_EXTENSION = 6,
+  CMP_EXTENSION = 7,
+};
+
+static void emit_alu_immediate(unsigned char **p, bool W, unsigned extension,
+                               unsigned reg, unsigned i) {
+  emit_rex(p, W, 0, reg);
+  emit_byte(p, 0x81);
+  emit_byte(p, 0xc0 | (extension << 3) | (reg & 7));
+  emit_word(p, i);
+}
+
+// Accessing a word of a page through its 'words' pointer, i.e., 'mov rax,
+// [rdx + words]' followed by 'op r32, [rax + 4*r11]' for 'mov' (0x8b),
+// 'add' (0x03), 'or' (0x0b), 'and' (0x23), 'sub' (0x2b) and 'xor' (0x33),
+// or 'mov [rax + 4*r11], r32' (0x89).
+
+enum {
+  MOV_LOAD = 0x8b,
+  MOV_STORE = 0x89,
+  ADD_LOAD = 0x03,
+  OR_LOAD = 0x0b,
+  AND_LOAD = 0x23,
+  SUB_LOAD = 0x2b,
+  XOR_LOAD = 0x33,
+};
+
+static void emit_page_word(unsigned char **p, unsigned opcode, unsigned reg) {
+  assert(!offsetof(struct page, words));
+  emit_byte(p, 0x48), emit_byte(p, 0x8b), emit_byte(p, 0x02); // mov rax, [rdx]
+  emit_byte(p, 0x42 | ((reg >> 3) << 2)); // REX with 'X' for 'r11'
+  emit_byte(p, opcode);
+  emit_byte(p, 0x04 | ((reg & 7) << 3)); // ModRM with SIB following
+  emit_byte(p, 0x98);                    // SIB 'rax + 4*r11'
+}
+
+// Test the valid bit of the word 'r11' of the page 'rdx' (clobbers 'rax').
+// The bit is moved into the carry flag by 'bt' on the bit-map word in a
+// register, since 'bt' with a register bit offset on memory is slow.
+
+static void emit_test_valid(unsigned char **p) {
+  emit_mov_register(p, RAX, R11);             // mov eax, r11d
+  emit_byte(p, 0xc1), emit_byte(p, 0xe8);     // shr eax,
+  emit_byte(p, LOG_VALID_BITS);               //   6
+  emit_byte(p, 0x48), emit_byte(p, 0x8b);     // mov rax,
+  emit_byte(p, 0x84), emit_byte(p, 0xc2);     //   [rdx + 8*rax
+  emit_word(p, offsetof(struct page, valid)); //    + valid]
+  emit_byte(p, 0x4c), emit_byte(p, 0x0f);     // bt rax,
+  emit_byte(p, 0xa3), emit_byte(p, 0xd8);     //   r11
+}
+
+// Set the valid bit of the word 'r11' of the page 'rdx' (clobbers 'rax'
+// and 'rdx') by read-modify-write of its bit-map word for the same reason.
+
+static void emit_set_valid(unsigned char **p) {
+  emit_mov_register(p, RAX, R11);             // mov eax, r11d
+  emit_byte(p, 0xc1), emit_byte(p, 0xe8);     // shr eax,
+  emit_byte(p, LOG_VALID_BITS);               //   6
+  emit_byte(p, 0x48), emit_byte(p, 0x8d);     // lea rdx,
+  emit_byte(p, 0x14), emit_byte(p, 0xc2);     //   [rdx + 8*rax]
+  emit_byte(p, 0x48), emit_byte(p, 0x8b);     // mov rax,
+  emit_byte(p, 0x82);                         //   [rdx
+  emit_word(p, offsetof(struct page, valid)); //    + valid]
+  emit_byte(p, 0x4c), emit_byte(p, 0x0f);     // bts rax,
+  emit_byte(p, 0xab), emit_byte(p, 0xd8);     //   r11
+  emit_byte(p, 0x48), emit_byte(p, 0x89);     // mov [rdx + valid],
+  emit_byte(p, 0x82);                         //   rax
+  emit_word(p, offsetof(struct page, valid));
+}
+
+// Accessing 'struct jit_state' through 'rdi' with 'mov' (0x8b) or store
+// 'mov' (0x89).
+
+static void emit_state(unsigned char **p, bool W, unsigned opcode,
+                       unsigned reg, size_t offset) {
+  assert(offset < 128);
+  emit_rex(p, W, reg, RDI);
+  emit_byte(p, opcode);
+  emit_byte(p, 0x40 | ((reg & 7) << 3) | RDI);
+  emit_byte(p, offset);
+}
+
+// Condition codes of 'jcc' (0x0f 0x80+cc) instructions.
+
+enum {
+  JB = 0x2,
+  JAE = 0x3,
+  JE = 0x4,
+  JNE = 0x5,
+  JL = 0xc,
+  JGE = 0xd,
+  JLE = 0xe,
+  JG = 0xf,
+};
+
+// Unresolved jumps return the address of their 'rel32' displacement.
+
+static unsigned char *emit_jcc(unsigned char **p, unsigned condition) {
+  emit_byte(p, 0x0f);
+  emit_byte(p, 0x80 + condition);
+  unsigned char *res = *p;
+  emit_word(p, 0);
+  return res;
+}
+
+static unsigned char *emit_jmp(unsigned char **p) {
+  emit_byte(p, 0xe9);
+  unsigned char *res = *p;
+  emit_word(p, 0);
+  return res;
+}
+
+//----------------------------------------------------------------------------//
+
+// Exit to the exact engine with 'PC' set to 'target' (at block entry).
+
+static void emit_exit(struct assembler *assembler, unsigned char **p,
+                      unsigned target) {
+  emit_mov_immediate(p, RAX, target);
+  patch(emit_jmp(p), assembler->exit);
+}
+
+// Exit to the exact engine without executing the current instruction.  Its
+// steps and those of the rest of its basic block are given back.
+
+static const unsigned char *emit_exit_current(struct assembler *assembler,
+                                              size_t PC) {
+  const unsigned char *res = assembler->cold;
+  unsigned char **p = &assembler->cold;
+  emit_alu_immediate(p, true, ADD_EXTENSION, RCX,
+                     assembler->code[PC].length); // add rcx, length
+  emit_exit(assembler, p, PC);
+  return res;
+}
+
+// With sampling the 'PC' of an entered basic block is stored to the mirror
+// 'sampled_PC' through 'eax', which is not used across instructions.
+
+static void emit_sample(unsigned char **p, unsigned target) {
+  emit_mov_immediate(p, RAX, target);
+  emit_byte(p, 0xa3); // mov [moffs64], eax
+  const uint64_t mirror = (uintptr_t)&sampled_PC;
+  memcpy(*p, &mirror, 8);
+  *p += 8;
+}
+
+// Enter the basic block at 'target' from the jump at 'PC'.  If the entered
+// block immediately follows the emitted code, i.e., at '*p' the code of
+// the instruction 'target' is emitted next, the final jump is omitted.
+
+static void emit_enter(struct assembler *assembler, unsigned char **p,
+                       size_t PC, unsigned target, bool follows,
+                       const unsigned char **exit_current) {
+  if (target == PC) { // Self-loop.
+    if (!*exit_current)
+      *exit_current = emit_exit_current(assembler, PC);
+    patch(emit_jmp(p), *exit_current);
+  } else if (target >= assembler->size)
+    emit_exit(assembler, p, target);
+  else {
+    const unsigned length = assembler->code[target].length;
+    emit_alu_immediate(p, true, CMP_EXTENSION, RCX, length); // cmp rcx, length
+    unsigned char *too_few_steps = emit_jcc(p, JB);
+    emit_alu_immediate(p, true, SUB_EXTENSION, RCX, length); // sub rcx, length
+    if (sampling)
+      emit_sample(p, target);
+    if (follows) {
+      patch(too_few_steps, assembler->cold);
+      emit_exit(assembler, &assembler->cold, target);
+    } else {
+      assembler->top->at = emit_jmp(p);
+      assembler->top->target = target;
+      assembler->top++;
+      patch(too_few_steps, *p);
+      emit_exit(assembler, p, target);
+    }
+  }
+}
+
+// Compute address 'eax' of a memory access from 'reg' (or zero if 'RAX').
+
+static void emit_address(unsigned char **p, unsigned reg, unsigned i) {
+  if (reg == RAX)
+    emit_mov_immediate(p, RAX, i);
+  else {
+    emit_mov_register(p, RAX, reg);
+    emit_alu_immediate(p, false, ADD_EXTENSION, RAX, i);
+  }
+}
+
+// Walk the page table for the address 'eax' as 'find_page' does and leave
+// the page in 'rdx' and the index of the word in 'r11'.  The two jumps
+// taken for missing tables and pages are returned unresolved in 'missing'.
+
+static void emit_find_page(unsigned char **p, unsigned char *missing[2]) {
+  emit_mov_register(p, RDX, RAX); // mov edx, eax
+  emit_byte(p, 0xc1), emit_byte(p, 0xea);
+  emit_byte(p, LOG_PAGE_SIZE + LOG_TABLE_SIZE); // shr edx, 22
+  emit_byte(p, 0x48), emit_byte(p, 0x8b), emit_byte(p, 0x14);
+  emit_byte(p, 0xd6); // mov rdx, [rsi + 8*rdx]
+  emit_byte(p, 0x48), emit_byte(p, 0x85), emit_byte(p, 0xd2); // test rdx, rdx
+  missing[0] = emit_jcc(p, JE);
+  emit_mov_register(p, R11, RAX); // mov r11d, eax
+  emit_byte(p, 0x41), emit_byte(p, 0xc1), emit_byte(p, 0xeb);
+  emit_byte(p, LOG_PAGE_SIZE); // shr r11d, 12
+  emit_alu_immediate(p, false, AND_EXTENSION, R11, TABLE_SIZE - 1);
+  emit_byte(p, 0x4a), emit_byte(p, 0x8b), emit_byte(p, 0x14);
+  emit_byte(p, 0xda); // mov rdx, [rdx + 8*r11]
+  emit_byte(p, 0x48), emit_byte(p, 0x85), emit_byte(p, 0xd2); // test rdx, rdx
+  missing[1] = emit_jcc(p, JE);
+  emit_mov_register(p, R11, RAX); // mov r11d, eax
+  emit_alu_immediate(p, false, AND_EXTENSION, R11, PAGE_SIZE - 1);
+}
+
+// Load the word at 'eax' and combine it with 'reg' through 'opcode'.
+// Reading uninitialized data is left to the exact engine unless ignored.
+// Then missing pages read as zero, which only matters for 'mov' and 'and',
+// unless they still have to be created from the data image.
+
+static void emit_load(struct assembler *assembler, unsigned char **p,
+                      size_t PC, unsigned opcode, unsigned reg,
+                      const unsigned char **exit_current) {
+  unsigned char *missing[2];
+  emit_find_page(p, missing);
+  if (debug < 0 && !assembler->image) {
+    emit_page_word(p, opcode, reg);
+    patch(missing[0], assembler->cold);
+    patch(missing[1], assembler->cold);
+    if (opcode == MOV_LOAD || opcode == AND_LOAD)
+      emit_mov_immediate(&assembler->cold, reg, 0);
+    patch(emit_jmp(&assembler->cold), *p);
+  } else {
+    if (!*exit_current)
+      *exit_current = emit_exit_current(assembler, PC);
+    patch(missing[0], *exit_current);
+    patch(missing[1], *exit_current);
+    if (debug >= 0) {
+      emit_test_valid(p);
+      patch(emit_jcc(p, JAE), *exit_current); // jnc
+    }
+    emit_page_word(p, opcode, reg);
+  }
+}
+
+// Store 'ACC' at 'eax' and mark it as valid.  Allocating missing pages (or
+// creating them from the data image) is left to the exact engine.
+
+static void emit_store(struct assembler *assembler, unsigned char **p,
+                       size_t PC, const unsigned char **exit_current) {
+  unsigned char *missing[2];
+  emit_find_page(p, missing);
+  if (!*exit_current)
+    *exit_current = emit_exit_current(assembler, PC);
+  patch(missing[0], *exit_current);
+  patch(missing[1], *exit_current);
+  emit_page_word(p, MOV_STORE, R10); // mov [rax + 4*r11], r10d
+  emit_set_valid(p);
+}
+
+// Compile the instruction at 'PC' into the hot code area.
+
+static void compile_instruction(struct assembler *assembler, size_t PC) {
+
+  const struct decoded *decoded = assembler->code + PC;
+  const unsigned immediate = decoded->immediate;
+  const unsigned D = host_registers[decoded->destination];
+  const unsigned char *exit_current = 0;
+  unsigned char **p = &assembler->hot;
+
+  // Operation of 'r32, r/m32' (memory) and 'r/m32, imm32' (immediate) forms.
+
+  unsigned memory_opcode = 0, extension = 0;
+  unsigned condition = 0;
+
+  // Fused instructions are compiled one by one (the fused 'fast_opcode'
+  // only affects the interpreter).
+
+  switch (decoded->fast_opcode == EXACT ? EXACT : decoded->opcode) {
+
+  case LOAD: // LOAD D i
+    emit_address(p, RAX, immediate);
+    emit_load(assembler, p, PC, MOV_LOAD, D, &exit_current);
+    break;
+  case LOADIN1: // LOADIN1 D i
+    emit_address(p, R8, immediate);
+    emit_load(assembler, p, PC, MOV_LOAD, D, &exit_current);
+    break;
+  case LOADIN2: // LOADIN2 D i
+    emit_address(p, R9, immediate);
+    emit_load(assembler, p, PC, MOV_LOAD, D, &exit_current);
+    break;
+  case LOADI: // LOADI D i
+    emit_mov_immediate(p, D, immediate);
+    break;
+
+  case STORE: // STORE i
+    emit_address(p, RAX, immediate);
+    emit_store(assembler, p, PC, &exit_current);
+    break;
+  case STOREIN1: // STOREIN1 i
+    emit_address(p, R8, immediate);
+    emit_store(assembler, p, PC, &exit_current);
+    break;
+  case STOREIN2: // STOREIN2 i
+    emit_address(p, R9, immediate);
+    emit_store(assembler, p, PC, &exit_current);
+    break;
+  case MOVE: // MOVE S D
+    if (decoded->source != decoded->destination)
+      emit_mov_register(p, D, host_registers[decoded->source]);
+    break;
+
+  case SUBI: // SUBI D i
+    extension = SUB_EXTENSION;
+    goto COMPUTE_IMMEDIATE;
+  case ADDI: // ADDI D i
+    extension = ADD_EXTENSION;
+    goto COMPUTE_IMMEDIATE;
+  case OPLUSI: // OPLUSI D i
+    extension = XOR_EXTENSION;
+    goto COMPUTE_IMMEDIATE;
+  case ORI: // ORI D i
+    extension = OR_EXTENSION;
+    goto COMPUTE_IMMEDIATE;
+  case ANDI: // ANDI D i
+    extension = AND_EXTENSION;
+  COMPUTE_IMMEDIATE:
+    emit_alu_immediate(p, false, extension, D, immediate);
+    break;
+
+  case SUB: // SUB D i
+    memory_opcode = SUB_LOAD;
+    goto COMPUTE_MEMORY;
+  case ADD: // ADD D i
+    memory_opcode = ADD_LOAD;
+    goto COMPUTE_MEMORY;
+  case OPLUS: // OPLUS D i
+    memory_opcode = XOR_LOAD;
+    goto COMPUTE_MEMORY;
+  case OR: // OR D i
+    memory_opcode = OR_LOAD;
+    goto COMPUTE_MEMORY;
+  case AND: // AND D i
+    memory_opcode = AND_LOAD;
+  COMPUTE_MEMORY:
+    emit_address(p, RAX, immediate);
+    emit_load(assembler, p, PC, memory_opcode, D, &exit_current);
+    break;
+
+  case NOP: // NOP
+    break;
+  case JUMPGT: // JUMP> i
+    condition = JG;
+    goto BRANCH;
+  case JUMPEQ: // JUMP= i
+    condition = JE;
+    goto BRANCH;
+  case JUMPGE: // JUMP>= i
+    condition = JGE;
+    goto BRANCH;
+  case JUMPLT: // JUMP< i
+    condition = JL;
+    goto BRANCH;
+  case JUMPNE: // JUMP!= i
+    condition = JNE;
+    goto BRANCH;
+  case JUMPLE: // JUMP<= i
+    condition = JLE;
+  BRANCH:
+    emit_byte(p, 0x45), emit_byte(p, 0x85), emit_byte(p, 0xd2); // test r10d
+    patch(emit_jcc(p, condition), assembler->cold);
+    emit_enter(assembler, &assembler->cold, PC, PC + immediate, false,
+               &exit_current);
+    emit_enter(assembler, p, PC, PC + 1, true, &exit_current);
+    break;
+  case JUMP: // JUMP i
+    emit_enter(assembler, p, PC, PC + immediate, false, &exit_current);
+    break;
+
+  default:
+    assert(decoded->fast_opcode == EXACT);
+    exit_current = emit_exit_current(assembler, PC);
+    patch(emit_jmp(p), exit_current);
+    break;
+  }
+}
+
+// Compile the whole program (including the sentinel).  Returns 'false' if
+// executable memory is not available.
+
+static bool compile(const struct decoded *code, size_t size, bool image) {
+
+  if (size >= MAX_JIT_SIZE) // Keeps all displacements within 32 bits.
+    return false;
+
+  const size_t hot_bytes = (size + 1) * HOT_BYTES;
+  jit.bytes = ENTRY_EXIT_BYTES + hot_bytes + (size + 1) * COLD_BYTES;
+  jit.buffer = mmap(0, jit.bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jit.buffer == MAP_FAILED) {
+    jit.buffer = 0;
+    return false;
+  }
+
+  jit.compiled = malloc((size + 1) * sizeof *jit.compiled);
+  struct fixup *fixups = malloc((size + 1) * sizeof *fixups);
+  if (!jit.compiled || !fixups)
+    die("can not allocate JIT compiler tables");
+
+  struct assembler assembler;
+  assembler.hot = jit.buffer;
+  assembler.cold = jit.buffer + ENTRY_EXIT_BYTES + hot_bytes;
+  assembler.code = code;
+  assembler.size = size;
+  assembler.image = image;
+  assembler.fixups = assembler.top = fixups;
+
+  unsigned char **p = &assembler.hot;
+
+  // The entry code loads the state and jumps to the compiled instruction.
+
+  jit.call = (void (*)(struct jit_state *))jit.buffer;
+  emit_state(p, false, 0x8b, R8, offsetof(struct jit_state, R[IN1_CODE]));
+  emit_state(p, false, 0x8b, R9, offsetof(struct jit_state, R[IN2_CODE]));
+  emit_state(p, false, 0x8b, R10, offsetof(struct jit_state, R[ACC_CODE]));
+  emit_state(p, true, 0x8b, RCX, offsetof(struct jit_state, remaining));
+  emit_state(p, true, 0x8b, RSI, offsetof(struct jit_state, memory));
+  emit_byte(p, 0xff), emit_byte(p, 0x67); // jmp [rdi + entry]
+  emit_byte(p, offsetof(struct jit_state, entry));
+
+  // The common exit code saves the state and returns to the caller.
+
+  assembler.exit = *p;
+  emit_state(p, false, 0x89, RAX, offsetof(struct jit_state, R[PC_CODE]));
+  emit_state(p, false, 0x89, R8, offsetof(struct jit_state, R[IN1_CODE]));
+  emit_state(p, false, 0x89, R9, offsetof(struct jit_state, R[IN2_CODE]));
+  emit_state(p, false, 0x89, R10, offsetof(struct jit_state, R[ACC_CODE]));
+  emit_state(p, true, 0x89, RCX, offsetof(struct jit_state, remaining));
+  emit_byte(p, 0xc3); // ret
+
+  assert(*p <= jit.buffer + ENTRY_EXIT_BYTES);
+  assembler.hot = jit.buffer + ENTRY_EXIT_BYTES;
+
+  for (size_t PC = 0; PC <= size; PC++) {
+#ifndef NDEBUG
+    const unsigned char *hot = assembler.hot, *cold = assembler.cold;
+#endif
+    jit.compiled[PC] = assembler.hot;
+    compile_instruction(&assembler, PC);
+    assert(assembler.hot <= hot + HOT_BYTES);
+    assert(assembler.cold <= cold + COLD_BYTES);
+  }
+
+  for (struct fixup *f = fixups; f != assembler.top; f++)
+    patch(f->at, jit.compiled[f->target]);
+  free(fixups);
+
+  if (mprotect(jit.buffer, jit.bytes, PROT_READ | PROT_EXEC)) {
+    munmap(jit.buffer, jit.bytes);
+    free(jit.compiled);
+    jit.buffer = 0;
+    jit.compiled = 0;
+    return false;
+  }
+
+  return true;
+}
+
+// Execute compiled code instead of 'execute_fast' with the same semantics.
+
+static void execute_jit(struct emulator *emulator) {
+
+  struct reti *reti = &emulator->reti;
+  struct shadow *shadow = &emulator->shadow;
+
+  const unsigned PC = reti->PC;
+  if (PC >= shadow->code)
+    return;
+  const size_t length = reti->decoded[PC].length;
+  const size_t remaining = limit - emulator->steps;
+  if (length > remaining)
+    return;
+
+  struct jit_state state;
+  state.R[IN1_CODE] = reti->IN1;
+  state.R[IN2_CODE] = reti->IN2;
+  state.R[ACC_CODE] = reti->ACC;
+  state.remaining = remaining - length;
+  state.memory = &reti->data;
+  state.entry = jit.compiled[PC];
+  if (sampling)
+    sampled_PC = PC;
+
+  jit.call(&state);
+
+  reti->PC = state.R[PC_CODE];
+  reti->IN1 = state.R[IN1_CODE];
+  reti->IN2 = state.R[IN2_CODE];
+  reti->ACC = state.R[ACC_CODE];
+  emulator->steps = limit - state.remaining;
+}
+
+static void release_jit(void) {
+  if (!jit.buffer)
+    return;
+  munmap(jit.buffer, jit.bytes);
+  free(jit.compiled);
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+// Execute basic blocks with compiled code if available.
+
+static void execute_blocks(struct emulator *emulator) {
+#ifdef JIT
+  if (jit.buffer) {
+    execute_jit(emulator);
+    return;
+  }
+#endif
+  execute_fast(emulator, 0, 0);
+}
+
+//----------------------------------------------------------------------------//
+
+// Run the emulation until we get to a self-loop or reach undefined code.
+
+static inline __attribute__((always_inline)) void
+emulation(struct emulator *emulator, const bool stepping,
+          const int debugging, const bool limited) {
+  for (;;) {
+    if (!stepping)
+      execute_blocks(emulator);
+    if (!stepping && recorder.requested)
+      dump_requested_recorder();
+    if (!execute_exactly(emulator, stepping, debugging, limited))
+      break;
+  }
+}
+
+// These are the specialized copies of the emulation loop.  Stepping is slow
+// anyway and thus only has one copy checking the other options at run-time.
+//
+// Steps before 'trace_from' are executed without stepping as fast as
+// possible (by temporarily lowering the steps limit) and so are the steps
+// after 'trace_to'.  Within this window and if only a 'PC' range is traced,
+// the fast engine runs on a copy of the decoded code in which instructions
+// in that range are 'EXACT' (see 'decode_traced').  Thus it hands over to
+// the exact engine only at instructions which need to be recorded.
+
+static struct decoded *traced; // Decoded code for '--trace-pc'.
+
+static struct decoded *decode_traced(const unsigned *code, size_t size) {
+  struct decoded *res = decode_code(code, size);
+  if (!res)
+    return 0;
+  for (size_t i = trace_lo; i < size && i <= trace_hi; i++)
+    res[i].fast_opcode = EXACT;
+  compute_lengths(res, size);
+  execute_fast(0, res, size);
+  return res;
+}
+
+// Run fast up to step 'from - 1' and then exactly with stepping up to step
+// 'to' (both capped by the steps limit).  Returns 'false' if the emulation
+// stopped before.
+
+static bool step_window(struct emulator *emulator, size_t from, size_t to) {
+  struct reti *reti = &emulator->reti;
+  const size_t saved_limit = limit;
+  bool running = true;
+  limit = from - 1 < saved_limit ? from - 1 : saved_limit;
+  while (running && emulator->steps != limit) {
+    execute_blocks(emulator);
+    if (emulator->steps != limit)
+      running = execute_exactly(emulator, false, debug, false);
+  }
+  struct decoded *decoded = reti->decoded;
+  if (traced)
+    reti->decoded = traced;
+  limit = to < saved_limit ? to : saved_limit;
+  while (running && emulator->steps != limit) {
+    if (traced)
+      execute_fast(emulator, 0, 0);
+    if (emulator->steps != limit)
+      running = execute_exactly(emulator, true, debug, false);
+  }
+  reti->decoded = decoded;
+  limit = saved_limit;
+  return running;
+}
+
+static void emulate_stepping(struct emulator *emulator) {
+  if (step_window(emulator, trace_from, trace_to))
+    emulation(emulator, false, debug, limit != ~(size_t)0);
+}
+
+static void emulate_warning(struct emulator *emulator) {
+  emulation(emulator, false, 0, false);
+}
+
+static void emulate_warning_limited(struct emulator *emulator) {
+  emulation(emulator, false, 0, true);
+}
+
+static void emulate_stopping(struct emulator *emulator) {
+  emulation(emulator, false, 1, false);
+}
+
+static void emulate_stopping_limited(struct emulator *emulator) {
+  emulation(emulator, false, 1, true);
+}
+
+static void emulate_ignoring(struct emulator *emulator) {
+  emulation(emulator, false, -1, false);
+}
+
+static void emulate_ignoring_limited(struct emulator *emulator) {
+  emulation(emulator, false, -1, true);
+}
+
+static void (*emulate)(struct emulator *) = emulate_warning;
+
+// Pick the copy of the emulation loop matching the options once they are
+// parsed.  It is then used for all runs (also in batch mode).
+
+static void select_emulation(void) {
+  static void (*const emulations[2][3])(struct emulator *) = {
+      {emulate_ignoring, emulate_warning, emulate_stopping},
+      {emulate_ignoring_limited, emulate_warning_limited,
+       emulate_stopping_limited},
+  };
+  if (step || trace.path)
+    emulate = emulate_stepping;
+  else
+    emulate = emulations[limit != ~(size_t)0][debug + 1];
+}
+
+//----------------------------------------------------------------------------//
+
+// Load the data file as initial data memory (mapped if possible).
+
+static void load_data(struct memory *memory, const char *data_path) {
+  FILE *data_file = 0;
+  bool close_data_file = false;
+  if (!strcmp(data_path, "-"))
+    data_path = "<stdin>", data_file = stdin;
+  else if (!file_exists(data_path))
+    die("data file '%s' does not exist", data_path);
+  else if (!(data_file = fopen(data_path, "r")))
+    die("can not read data file '%s'", data_path);
+  else
+    close_data_file = true;
+  if (running && close_data_file)
+    running->input = data_file;
+  struct parser parser;
+  init_parser(&parser, data_file, data_path);
+#ifdef MMAP
+  if (close_data_file)
+    memory->image =
+        map_file(data_file, PROT_READ | PROT_WRITE, &memory->size_image);
+  if (memory->image && memory->size_image > CAPACITY)
+    die("capacity of data area reached");
+#endif
+  size_t address = 0;
+  unsigned word;
+  while (!memory->image && next_word(&parser, &word)) {
+    if (address == CAPACITY)
+      die("capacity of data area reached");
+    write_memory(memory, address++, word);
+  }
+  if (close_data_file)
+    fclose(data_file);
+  if (running)
+    running->input = 0;
+}
+
+//----------------------------------------------------------------------------//
+
+// The profile is written as listing in the format of 'disreti' with the
+// number of executions of each instruction, its share of all steps, the
+// taken and not taken jumps and the memory reads and writes (each executed
+// load, compute-memory or store instruction accesses memory exactly once).
+// It is also written at exit, such that it is available if the emulation
+// dies (say on an illegal instruction).
+
+static struct {
+  const char *path;              // Option '--profile=<file>'.
+  bool hot;                      // Sort by counts ('--profile-hot').
+  bool written;                  // Only written once.
+  const unsigned *code;          // Program code.
+  const struct decoded *decoded; // To find basic blocks.
+  size_t size;                   // Number of instructions.
+  const uint64_t *counts;        // Executions (while sorting).
+} profile;
+
+static int compare_hot(const void *p, const void *q) {
+  const size_t i = *(const size_t *)p, j = *(const size_t *)q;
+  const uint64_t a = profile.counts[i], b = profile.counts[j];
+  if (a != b)
+    return a > b ? -1 : 1;
+  return i < j ? -1 : i > j;
+}
+
+// Sum up entering and leaving basic blocks along each basic block, which
+// gives the number of executions of each instruction.
+
+static uint64_t *count_executions(void) {
+  const size_t size = profile.size;
+  uint64_t *counts = malloc((size + 1) * sizeof *counts);
+  if (!counts)
+    return 0;
+  int64_t entered = 0;
+  for (size_t i = 0; i != size; i++) {
+    if (!i || profile.decoded[i - 1].length == 1)
+      entered = 0;
+    entered += counters[i].entered;
+    counts[i] = (uint64_t)entered + counters[i].exact;
+  }
+  return counts;
+}
+
+static void write_profile(void) {
+  if (!counters || !profile.path || profile.written)
+    return;
+  profile.written = true;
+
+  const size_t size = profile.size;
+  uint64_t *counts = count_executions();
+  size_t *order = malloc((size + 1) * sizeof *order);
+  if (!counts || !order) {
+    warn("can not allocate profile");
+    free(counts);
+    free(order);
+    return;
+  }
+  uint64_t total = 0;
+  for (size_t i = 0; i != size; i++) {
+    total += counts[i];
+    order[i] = i;
+  }
+  profile.counts = counts;
+  if (profile.hot)
+    qsort(order, size, sizeof *order, compare_hot);
+
+  FILE *file = fopen(profile.path, "w");
+  if (file) {
+    fprintf(file, "; profile of %zu instructions and %" PRIu64 " steps\n",
+            size, total);
+    fprintf(file, "%-21s ; PC       CODE     %12s %7s %12s %12s %12s %12s\n",
+            "; INSTRUCTION", "COUNT", "PERCENT", "TAKEN", "NOT-TAKEN", "READS",
+            "WRITES");
+    for (size_t k = 0; k != size; k++) {
+      const size_t i = order[k];
+      const unsigned code = profile.code[i];
+      const uint64_t count = counts[i];
+      char instruction[disassembled_reti_code_length];
+      format_reti_code(code, instruction);
+      fprintf(file, "%-21s ; %08x %08x %12" PRIu64 " %6.2f%%", instruction,
+              (unsigned)i, code, count, total ? 100.0 * count / total : 0.0);
+      const enum opcode opcode = reti_opcode(code);
+      if (JUMPGT <= opcode && opcode <= JUMP)
+        fprintf(file, " %12" PRIu64 " %12" PRIu64, counters[i].taken,
+                count - counters[i].taken);
+      else if ((LOAD <= opcode && opcode <= LOADIN2) ||
+               (SUB <= opcode && opcode <= AND))
+        fprintf(file, " %12s %12s %12" PRIu64, "", "", count);
+      else if (STORE <= opcode && opcode <= STOREIN2)
+        fprintf(file, " %12s %12s %12s %12" PRIu64, "", "", "", count);
+      fputc('\n', file);
+    }
+  }
+  if (!file || fclose(file))
+    warn("can not write profile '%s'", profile.path);
+
+  profile.counts = 0;
+  free(counts);
+  free(order);
+}
+
+//----------------------------------------------------------------------------//
+
+// With '--stats' statistics of the run and the wall-clock time of its
+// phases are printed to '<stderr>' at the end.  The instruction mix is
+// determined from the same counters as the profile.
+
+enum phase { ALLOCATION, CODE_LOAD, DATA_LOAD, EXECUTION, DUMP, PHASES };
+
+static const char *const phase_names[PHASES] = {
+    "allocation", "code load", "data load", "execution", "dump",
+};
+
+static bool statistics; // Option '--stats'.
+static double phase_times[PHASES];
+static double phase_started;
+
+static double wall_clock_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Add the time since the previous phase ended to 'phase' (which allows to
+// interrupt a phase by another one).
+
+static void end_phase(enum phase phase) {
+  const double now = wall_clock_time();
+  phase_times[phase] += now - phase_started;
+  phase_started = now;
+}
+
+static double percent(double a, double b) { return b ? 100.0 * a / b : 0; }
+
+static void print_statistics(struct emulator *emulator) {
+  enum { LOADS, STORES, COMPUTES, JUMPS, CLASSES };
+  static const char *const class_names[CLASSES] = {
+      "load instructions",
+      "store instructions",
+      "compute instructions",
+      "jump instructions",
+  };
+  uint64_t classes[CLASSES] = {0, 0, 0, 0}, steps = 0;
+  uint64_t *counts = count_executions();
+  if (!counts)
+    die("can not allocate statistics");
+  for (size_t i = 0; i != profile.size; i++) {
+    const enum opcode opcode = reti_opcode(profile.code[i]);
+    if (opcode == ILLEGAL)
+      continue;
+    if (opcode <= LOADI)
+      classes[LOADS] += counts[i];
+    else if (opcode <= MOVE)
+      classes[STORES] += counts[i];
+    else if (opcode < NOP)
+      classes[COMPUTES] += counts[i];
+    else
+      classes[JUMPS] += counts[i];
+    steps += counts[i];
+  }
+  free(counts);
+
+  struct rusage usage;
+  const long peak = getrusage(RUSAGE_SELF, &usage) ? 0 : usage.ru_maxrss;
+
+  double total = 0;
+  for (unsigned i = 0; i != PHASES; i++)
+    total += phase_times[i];
+  const double execution = phase_times[EXECUTION];
+
+  fflush(stdout);
+  fputs("emreti: statistics:\n", stderr);
+  fprintf(stderr, "  %-22s %14" PRIu64 "\n", "steps", steps);
+  for (unsigned c = 0; c != CLASSES; c++)
+    fprintf(stderr, "  %-22s %14" PRIu64 " %6.2f%%\n", class_names[c],
+            classes[c], percent(classes[c], steps));
+  fprintf(stderr, "  %-22s %14" PRIu64 "\n", "uninitialized reads",
+          emulator->uninitialized);
+  fprintf(stderr, "  %-22s %14zu\n", "valid data words",
+          count_memory(&emulator->reti.data));
+  fprintf(stderr, "  %-22s %14.1f MB\n", "peak resident set", peak / 1024.0);
+  for (unsigned i = 0; i != PHASES; i++)
+    fprintf(stderr, "  %-22s %14.6f s %6.2f%%\n", phase_names[i],
+            phase_times[i], percent(phase_times[i], total));
+  fprintf(stderr, "  %-22s %14.6f s\n", "total", total);
+  fprintf(stderr, "  %-22s %14.2f MIPS\n", "speed",
+          execution ? steps / execution / 1e6 : 0);
+}
+
+//----------------------------------------------------------------------------//
+
+#ifdef PERF
+
+// With '--hw-counters' hardware counters of the host are enabled only
+// while the program is executed and printed to '<stderr>' at the end, in
+// total and per executed ReTI instruction.  They show whether dispatch
+// (branch misses) or the sparse data memory (cache and TLB misses) limits
+// the emulation.  Counters not supported by the host (or not allowed by
+// the kernel, see '/proc/sys/kernel/perf_event_paranoid') are skipped.
+
+#define HARDWARE_CACHE(CACHE)                                                  \
+  (PERF_COUNT_HW_CACHE_##CACHE | (PERF_COUNT_HW_CACHE_OP_READ << 8) |          \
+   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct hardware_counter {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+  int fd;         // Negative if not opened.
+  uint64_t value; // Scaled if the counter was multiplexed.
+  bool scaled;
+} hardware_counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1, 0, false},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, 0,
+     false},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, 0,
+     false},
+    {"L1d read misses", PERF_TYPE_HW_CACHE, HARDWARE_CACHE(L1D), -1, 0,
+     false},
+    {"LLC read misses", PERF_TYPE_HW_CACHE, HARDWARE_CACHE(LL), -1, 0, false},
+    {"dTLB read misses", PERF_TYPE_HW_CACHE, HARDWARE_CACHE(DTLB), -1, 0,
+     false},
+};
+
+#define HARDWARE_COUNTERS                                                      \
+  (sizeof hardware_counters / sizeof *hardware_counters)
+
+static bool hardware; // Option '--hw-counters'.
+
+// Open all counters disabled and only counting this thread in user mode
+// (thus not the step printer thread).  If none can be opened we only warn.
+
+static void open_hardware_counters(void) {
+  unsigned opened = 0;
+  int error = 0;
+  for (size_t i = 0; i != HARDWARE_COUNTERS; i++) {
+    struct hardware_counter *counter = hardware_counters + i;
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = counter->type;
+    attr.config = counter->config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    counter->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counter->fd < 0)
+      error = errno;
+    else
+      opened++;
+  }
+  if (!opened)
+    warn("can not open hardware counters (%s)", strerror(error));
+}
+
+static void enable_hardware_counters(void) {
+  for (size_t i = 0; i != HARDWARE_COUNTERS; i++)
+    if (hardware_counters[i].fd >= 0) {
+      ioctl(hardware_counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(hardware_counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+// Disable and read all counters.  If the kernel had to multiplex counters
+// their values are extrapolated to the whole time they were enabled.
+
+static void disable_hardware_counters(void) {
+  for (size_t i = 0; i != HARDWARE_COUNTERS; i++) {
+    struct hardware_counter *counter = hardware_counters + i;
+    if (counter->fd < 0)
+      continue;
+    ioctl(counter->fd, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t values[3]; // Value, time enabled and time running.
+    if (read(counter->fd, values, sizeof values) != sizeof values) {
+      close(counter->fd);
+      counter->fd = -1;
+      continue;
+    }
+    counter->value = values[0];
+    if (values[2] && values[2] < values[1]) {
+      counter->value = (double)values[0] * values[1] / values[2];
+      counter->scaled = true;
+    }
+  }
+}
+
+static void print_hardware_counters(size_t steps) {
+  unsigned opened = 0;
+  for (size_t i = 0; i != HARDWARE_COUNTERS; i++)
+    opened += hardware_counters[i].fd >= 0;
+  if (!opened)
+    return;
+  fflush(stdout);
+  fprintf(stderr, "emreti: hardware counters of %zu steps:\n", steps);
+  for (size_t i = 0; i != HARDWARE_COUNTERS; i++) {
+    struct hardware_counter *counter = hardware_counters + i;
+    if (counter->fd < 0) {
+      fprintf(stderr, "  %-22s %14s\n", counter->name, "not supported");
+      continue;
+    }
+    fprintf(stderr, "  %-22s %14" PRIu64 " %10.3f per step%s\n",
+            counter->name, counter->value,
+            steps ? (double)counter->value / steps : 0,
+            counter->scaled ? " (scaled)" : "");
+    close(counter->fd);
+    counter->fd = -1;
+  }
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+// With '--sample=<hz>' the profiling timer sends 'SIGPROF' at the given
+// rate (of used processor time) during execution.  The handler only adds
+// the current 'sampled_PC' to a histogram, which is printed as flat profile
+// to '<stderr>' at the end and written as folded stacks for flame graph
+// scripts with '--sample-folded=<file>'.  As the fast engine and compiled
+// code only update the mirror when entering a basic block, samples are
+// attributed to the 'PC' where the current basic block was entered.  This
+// keeps the overhead low enough to sample fused and compiled execution.
+
+static struct {
+  unsigned rate;                // Option '--sample=<hz>'.
+  const char *folded;           // Option '--sample-folded=<file>'.
+  const char *program;          // Root frame of folded stacks.
+  const unsigned *code;         // To disassemble sampled instructions.
+  size_t size;                  // Last entry counts samples outside code.
+  volatile uint64_t *histogram; // Samples per 'PC'.
+  bool printed;                 // Only print once (also at exit).
+} sample;
+
+static void sample_PC(int sig) {
+  (void)sig;
+  const unsigned PC = sampled_PC;
+  sample.histogram[PC < sample.size ? PC : sample.size]++;
+}
+
+static void set_sample_timer(unsigned rate) {
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = rate ? 1000000 / rate : 0;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, 0))
+    die("can not set profiling timer");
+}
+
+static void start_sampling(void) {
+  if (!sampling)
+    return;
+  struct sigaction action;
+  memset(&action, 0, sizeof action);
+  action.sa_handler = sample_PC;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, 0))
+    die("can not install profiling signal handler");
+  set_sample_timer(sample.rate);
+}
+
+static void stop_sampling(void) {
+  if (sampling)
+    set_sample_timer(0);
+}
+
+static int compare_samples(const void *p, const void *q) {
+  const size_t i = *(const size_t *)p, j = *(const size_t *)q;
+  const uint64_t a = sample.histogram[i], b = sample.histogram[j];
+  if (a != b)
+    return a > b ? -1 : 1;
+  return i < j ? -1 : i > j;
+}
+
+// Sampled instructions are named by 'PC' and disassembled instruction,
+// which is also the frame name in folded stacks (no ';' in there).
+
+static void format_sampled(size_t PC, char *name) {
+  if (PC == sample.size) {
+    strcpy(name, "........ <outside>");
+    return;
+  }
+  char instruction[disassembled_reti_code_length];
+  format_reti_code(sample.code[PC], instruction);
+  sprintf(name, "%08zx %s", PC, instruction);
+}
+
+static void print_samples(void) {
+  if (!sampling || sample.printed)
+    return;
+  sample.printed = true;
+  stop_sampling();
+  size_t *order = malloc((sample.size + 1) * sizeof *order);
+  if (!order) {
+    warn("can not allocate samples");
+    return;
+  }
+  size_t sampled = 0;
+  uint64_t total = 0;
+  for (size_t i = 0; i <= sample.size; i++)
+    if (sample.histogram[i]) {
+      total += sample.histogram[i];
+      order[sampled++] = i;
+    }
+  qsort(order, sampled, sizeof *order, compare_samples);
+
+  char name[disassembled_reti_code_length + 16];
+  fflush(stdout);
+  fprintf(stderr, "emreti: %" PRIu64 " samples at %u Hz:\n", total,
+          sample.rate);
+  if (sampled)
+    fputs("  SAMPLES      PERCENT PC       INSTRUCTION\n", stderr);
+  for (size_t i = 0; i != sampled; i++) {
+    const size_t PC = order[i];
+    format_sampled(PC, name);
+    fprintf(stderr, "  %-12" PRIu64 " %6.2f%% %s\n", sample.histogram[PC],
+            percent(sample.histogram[PC], total), name);
+  }
+
+  if (sample.folded) {
+    FILE *file = fopen(sample.folded, "w");
+    if (!file)
+      warn("could not write folded samples file '%s'", sample.folded);
+    for (size_t i = 0; file && i != sampled; i++) {
+      const size_t PC = order[i];
+      for (const char *p = sample.program; *p; p++) // Keep frames apart.
+        fputc(*p == ';' || isspace(*p) ? '_' : *p, file);
+      format_sampled(PC, name);
+      fprintf(file, ";%s %" PRIu64 "\n", name, sample.histogram[PC]);
+    }
+    if (file && fclose(file))
+      warn("could not write folded samples file '%s'", sample.folded);
+  }
+  free(order);
+}
+
+//----------------------------------------------------------------------------//
+
+static int compare_pages(const void *p, const void *q) {
+  const unsigned a = (*(struct page *const *)p)->address;
+  const unsigned b = (*(struct page *const *)q)->address;
+  return a < b ? -1 : a > b;
+}
+
+// Print all valid words of the final data memory in address order.  Only
+// allocated pages are visited (sorted by address first), empty words of
+// their valid bit-maps are skipped and only set bits of the others are
+// visited.  Thus the cost is independent of the largest address written.
+
+static void print_memory(struct memory *memory, FILE *file) {
+  if (step)
+    fputs("ADDRESS  DATA     BYTES       "
+          "ASCII  UNSIGNED       SIGNED\n",
+          file);
+  load_image(memory);
+  qsort(memory->pages, memory->size_pages, sizeof *memory->pages,
+        compare_pages);
+  for (size_t i = 0; i != memory->size_pages; i++) {
+    const struct page *page = memory->pages[i];
+    for (size_t j = 0; j != PAGE_SIZE / VALID_BITS; j++)
+      for (uint64_t bits = page->valid[j]; bits; bits &= bits - 1) {
+        const size_t k = (j << LOG_VALID_BITS) + __builtin_ctzll(bits);
+        const unsigned address = page->address + k;
+        const unsigned word = page->words[k];
+        fprintf(file, "%08x %08x", address, word);
+        if (step) {
+          for (unsigned b = 0, tmp = word; b != 4; b++, tmp >>= 8)
+            fprintf(file, " %02x", tmp & 0xff);
+          fputc(' ', file);
+          for (unsigned b = 0, tmp = word; b != 4; b++, tmp >>= 8) {
+            int ch = tmp & 0xff;
+            fputc(isprint(ch) ? ch : '.', file);
+          }
+          fprintf(file, "%11u %12d", (unsigned)word, (int)word);
+        }
+        fputc('\n', file);
+      }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+// The data files of batch mode.  A directory stands for all its regular
+// (and not hidden) files in alphabetical order.
+
+struct paths {
+  char **start;
+  size_t size, capacity;
+};
+
+static void push_path(struct paths *paths, char *path) {
+  if (paths->size == paths->capacity) {
+    paths->capacity = paths->capacity ? 2 * paths->capacity : 16;
+    paths->start =
+        realloc(paths->start, paths->capacity * sizeof *paths->start);
+    if (!paths->start)
+      die("can not reallocate data paths");
+  }
+  paths->start[paths->size++] = path;
+}
+
+static char *copy_path(const char *directory, const char *name,
+                       const char *suffix) {
+  const size_t bytes = (directory ? strlen(directory) + 1 : 0) +
+                       strlen(name) + strlen(suffix) + 1;
+  char *res = malloc(bytes);
+  if (!res)
+    die("can not allocate path");
+  if (directory)
+    snprintf(res, bytes, "%s/%s%s", directory, name, suffix);
+  else
+    snprintf(res, bytes, "%s%s", name, suffix);
+  return res;
+}
+
+static int skip_hidden(const struct dirent *entry) {
+  return entry->d_name[0] != '.';
+}
+
+static void add_data_files(struct paths *paths, const char *path) {
+  struct stat buf;
+  if (stat(path, &buf) || !S_ISDIR(buf.st_mode)) {
+    push_path(paths, copy_path(0, path, ""));
+    return;
+  }
+  struct dirent **entries;
+  const int size = scandir(path, &entries, skip_hidden, alphasort);
+  if (size < 0)
+    die("can not read data directory '%s'", path);
+  for (int i = 0; i != size; i++) {
+    char *file = copy_path(path, entries[i]->d_name, "");
+    if (!stat(file, &buf) && S_ISREG(buf.st_mode))
+      push_path(paths, file);
+    else
+      free(file);
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+static const char *base_name(const char *path) {
+  const char *res = strrchr(path, '/');
+  return res ? res + 1 : path;
+}
+
+static int compare_base_names(const void *p, const void *q) {
+  return strcmp(base_name(*(char *const *)p), base_name(*(char *const *)q));
+}
 
+// All dump files go to the same output directory and are named after the
+// data files, which thus need to have different names.
+
+static void check_output_names(const struct paths *paths) {
+  char **sorted = malloc(paths->size * sizeof *sorted);
+  if (!sorted)
+    die("can not allocate data paths");
+  memcpy(sorted, paths->start, paths->size * sizeof *sorted);
+  qsort(sorted, paths->size, sizeof *sorted, compare_base_names);
+  for (size_t i = 1; i < paths->size; i++)
+    if (!compare_base_names(sorted + i - 1, sorted + i))
+      die("data files '%s' and '%s' have the same name "
+          "(output files would clash)",
+          sorted[i - 1], sorted[i]);
+  free(sorted);
+}
+
+//----------------------------------------------------------------------------//
+
+// Eight lanes of 32-bit words exactly fill one AVX2 register.  Wider
+// vectors are split by the compiler into single lanes and become slower.
+
+#define MAX_LANES 8
+
+static size_t lanes = 1; // Option '--lanes=<n>'.
+
+#ifdef LOCKSTEP
+
+// In batch mode up to 'MAX_LANES' runs can be executed in lockstep.  Their
+// registers are kept in vectors with one lane per run and every instruction
+// is executed for all lanes at its 'PC' at once while the other lanes are
+// masked out.  Always executing the smallest 'PC' of all lanes next lets
+// lanes which fell behind catch up, such that lanes with diverging control
+// flow reconverge, for instance after leaving a loop after different
+// numbers of iterations.  Only memory accesses go lane by lane to the data
+// memory of each run.  As in the fast engine, a lane leaves the lockstep
+// execution whenever anything unusual happens, without executing the
+// current instruction, and is then finished on its own.  On x86-64 Linux
+// this engine is compiled for AVX2 and the SSE2 baseline and the version
+// matching the host is selected at load time.
+
+typedef unsigned lanes_word __attribute__((vector_size(4 * MAX_LANES)));
+typedef int lanes_signed __attribute__((vector_size(4 * MAX_LANES)));
+
+#if defined(__x86_64__) && defined(__linux__)
+#define VECTORIZED __attribute__((target_clones("avx2", "default")))
+#else
+#define VECTORIZED
 #endif
 
-    // Now we decode the actual instruction and execute it.
+// Smallest word of all lanes by folding the upper half of the lanes onto
+// the lower half, which avoids accessing the lanes one by one.
+
+typedef unsigned lanes_half __attribute__((vector_size(2 * MAX_LANES)));
+typedef unsigned lanes_quarter __attribute__((vector_size(MAX_LANES)));
+
+static inline unsigned smallest_lane(const lanes_word *words) {
+  lanes_half lower, upper;
+  memcpy(&lower, words, sizeof lower);
+  memcpy(&upper, (const char *)words + sizeof lower, sizeof upper);
+  const lanes_half half =
+      lower ^ ((lower ^ upper) & (lanes_half)(upper < lower));
+  lanes_quarter low, up;
+  memcpy(&low, &half, sizeof low);
+  memcpy(&up, (char *)&half + sizeof low, sizeof up);
+  const lanes_quarter quarter = low ^ ((low ^ up) & (lanes_quarter)(up < low));
+  unsigned smallest = ~0u;
+  for (size_t i = 0; i != MAX_LANES / 4; i++)
+    if (quarter[i] < smallest)
+      smallest = quarter[i];
+  return smallest;
+}
 
-    switch (I31to30) {
+// Read a word for a lane as the fast engine does, i.e., fail on reading
+// an uninitialized word unless such reads are ignored.
+
+static bool read_lane(struct memory *memory, unsigned address,
+                      unsigned *word_ptr) {
+  const struct page *page = load_page(memory, address);
+  const size_t word = WORD_INDEX(address);
+  if (page && (debug < 0 || valid_word(page, word)))
+    *word_ptr = page->words[word];
+  else if (debug < 0)
+    *word_ptr = 0;
+  else
+    return false;
+  return true;
+}
 
-    case BV2(0, 1): // Load Instructions
-      switch (I31to28) {
-      case BV4(0, 1, 0, 0): // LOAD D i
-        address = unsigned_immediate;
-        result = M[address];
-        INSTRUCTION("LOAD %s %u", D_symbol, unsigned_immediate);
-        ACTION("%s = M(<0x%x>) = M(0x%x) = 0x%x", D_symbol, i, address, result);
-        M_read = true;
-        D_write = true;
-        break;
-      case BV4(0, 1, 0, 1): // LOADIN1 D i
-        address = IN1 + signed_immediate;
-        INSTRUCTION("LOADIN1 %s %d", D_symbol, signed_immediate);
-        ACTION("%s = M(<IN1> + <0x%x>) = M(0x%x + 0x%x) = M(0x%x) = 0x%x",
-               D_symbol, i, IN1, i, address, result);
-        result = M[address];
-        M_read = true;
-        D_write = true;
-        break;
-      case BV4(0, 1, 1, 0): // LOADIN2 D i
-        address = IN2 + signed_immediate;
-        INSTRUCTION("LOADIN2 %s %d", D_symbol, signed_immediate);
-        ACTION("%s = M(<IN2> + <0x%x>) = M(0x%x + 0x%x) = M(0x%x) = 0x%x",
-               D_symbol, i, IN2, i, address, result);
-        result = M[address];
-        M_read = true;
-        D_write = true;
-        break;
-      case BV4(0, 1, 1, 1): // LOADI D i
-        result = unsigned_immediate;
-        INSTRUCTION("LOADI %s %u", D_symbol, i);
-        ACTION("%s = 0x%x", D_symbol, i);
-        D_write = true;
-        break;
+VECTORIZED static void execute_lanes(struct emulator **emulators,
+                                     size_t size) {
+  const struct decoded *const code = emulators[0]->reti.decoded;
+  const size_t instructions = emulators[0]->shadow.code;
+
+  // Masks have all bits of lanes set which are still executed in lockstep
+  // ('active'), are at the current 'PC' ('mask') or take a jump ('taken').
+  // The steps executed by each lane are counted in 'executed' and only
+  // added to 'steps' when all active lanes used up their 'budget' of steps
+  // (which is at most what fits into 'executed'), after which each lane is
+  // checked against the steps limit again.
+
+  lanes_word R[4] = {0}, active = {0}, executed = {0};
+  size_t steps[MAX_LANES], budget = 0;
+  for (size_t i = 0; i != size; i++) {
+    for (unsigned r = PC_CODE; r <= ACC_CODE; r++)
+      R[r][i] = emulators[i]->reti.R[r];
+    steps[i] = emulators[i]->steps;
+    active[i] = ~0u;
+  }
+
+  // The smallest 'PC' of all active lanes only has to be searched for after
+  // jumps and if lanes left, since otherwise all lanes at 'PC' just move on
+  // to the next instruction, which then is the smallest 'PC'.
+
+  unsigned PC = 0;
+  bool search = true;
+
+  for (;;) {
+    if (!budget) {
+      budget = ~0u;
+      for (size_t i = 0; i != size; i++) {
+        steps[i] += executed[i];
+        if (active[i] && steps[i] == limit)
+          active[i] = 0;
+        else if (active[i] && limit - steps[i] < budget)
+          budget = limit - steps[i];
       }
-      break; // end of Load Instructions
-
-    case BV2(1, 0): // Store Instructions
-      switch (I31to28) {
-      case BV4(1, 0, 0, 0): // STORE i
-        address = unsigned_immediate;
-        result = ACC;
-        INSTRUCTION("STORE %u", i);
-        ACTION("M(<%u>) = M(0x%x) = 0x%x", i, address, result);
-        M_write = true;
-        break;
-      case BV4(1, 0, 0, 1): // STOREIN1 i
-        address = IN1 + signed_immediate;
-        result = ACC;
-        INSTRUCTION("STOREIN1 %d", signed_immediate);
-        ACTION("M(0x%x) = M(<IN1> + <0x%x>) = M(0x%x + 0x%x) = ACC = 0x%x",
-               address, i, IN1, i, result);
-        M_write = true;
-        break;
-      case BV4(1, 0, 1, 0): // STOREIN2 i
-        address = IN2 + signed_immediate;
-        result = ACC;
-        INSTRUCTION("STOREIN2 %d", signed_immediate);
-        ACTION("M(0x%x) = M(<IN2> + <0x%x>) = M(0x%x + 0x%x) = ACC = 0x%x",
-               address, i, IN2, i, result);
-        M_write = true;
-        break;
-      case BV4(1, 0, 1, 1): // MOVE S D
-        result = S;
-        INSTRUCTION("MOVE %s %s", S_symbol, D_symbol);
-        ACTION("%s = %s = 0x%x", D_symbol, S_symbol, result);
-        D_write = true;
+      executed = (lanes_word){0};
+      search = true;
+    }
+    if (search) {
+      const lanes_word waiting = R[PC_CODE] | ~active;
+      const lanes_word inactive = ~active;
+      PC = smallest_lane(&waiting);
+      if (PC == ~0u && smallest_lane(&inactive))
         break;
+      search = false;
+    }
+    lanes_word mask = active & (lanes_word)(R[PC_CODE] == PC);
+    if (PC >= instructions || code[PC].fast_opcode == EXACT) {
+      active &= ~mask;
+      search = true;
+      continue;
+    }
+    const struct decoded *decoded = code + PC;
+    const unsigned opcode = decoded->opcode, immediate = decoded->immediate;
+    const unsigned D = decoded->destination, S = decoded->source;
+    const lanes_signed ACC = (lanes_signed)R[ACC_CODE];
+    lanes_word taken;
+    switch (opcode) {
+    case LOAD:
+    case LOADIN1:
+    case LOADIN2:
+    case SUB:
+    case ADD:
+    case OPLUS:
+    case OR:
+    case AND:
+    case STORE:
+    case STOREIN1:
+    case STOREIN2: {
+      unsigned selected[MAX_LANES], registers[4][MAX_LANES];
+      memcpy(selected, &mask, sizeof selected);
+      memcpy(registers, R, sizeof registers);
+      for (size_t i = 0; i != size; i++) {
+        if (!selected[i])
+          continue;
+        struct memory *memory = &emulators[i]->reti.data;
+        unsigned address = immediate, word;
+        if (opcode == LOADIN1 || opcode == STOREIN1)
+          address += registers[IN1_CODE][i];
+        else if (opcode == LOADIN2 || opcode == STOREIN2)
+          address += registers[IN2_CODE][i];
+        if (STORE <= opcode && opcode <= STOREIN2)
+          write_memory(memory, address, registers[ACC_CODE][i]);
+        else if (!read_lane(memory, address, &word)) {
+          selected[i] = 0;
+          search = true;
+        } else if (opcode == SUB)
+          registers[D][i] -= word;
+        else if (opcode == ADD)
+          registers[D][i] += word;
+        else if (opcode == OPLUS)
+          registers[D][i] ^= word;
+        else if (opcode == OR)
+          registers[D][i] |= word;
+        else if (opcode == AND)
+          registers[D][i] &= word;
+        else
+          registers[D][i] = word;
       }
-      break; // end of Store Instructions
-
-    case BV2(0, 0): // Compute Instructions
-      D = *D_pointer;
-      switch (I31to26) {
-      case BV6(0, 0, 0, 0, 1, 0): // SUBI D i
-        result = D - signed_immediate;
-        INSTRUCTION("SUBI %s %d", D_symbol, signed_immediate);
-        ACTION("%s = %s - [0x%x] = %d - %d = %d = [0x%x]", D_symbol, D_symbol,
-               i, (int)D, (int)i, (int)result, result);
-        D_write = true;
-        break;
-      case BV6(0, 0, 0, 0, 1, 1): // ADDI D i
-        result = D + signed_immediate;
-        INSTRUCTION("ADDI %s %d", D_symbol, signed_immediate);
-        ACTION("%s = %s + [0x%x] = %d + %d = %d = [0x%x]", D_symbol, D_symbol,
-               i, (int)D, (int)i, (int)result, result);
-        D_write = true;
-        break;
-      case BV6(0, 0, 0, 1, 0, 0): // OPLUSI D i
-        result = D ^ unsigned_immediate;
-        INSTRUCTION("OPLUSI %s 0x%x", D_symbol, i);
-        ACTION("%s = %s ^ 0x%x = 0x%x ^ 0x%x = 0x%x", D_symbol, D_symbol,
-               unsigned_immediate, D, unsigned_immediate, result);
-        D_write = true;
-        break;
-      case BV6(0, 0, 0, 1, 0, 1): // ORI D i
-        result = D | unsigned_immediate;
-        INSTRUCTION("ORI %s 0x%x", D_symbol, i);
-        ACTION("%s = %s | 0x%x = 0x%x | 0x%x = 0x%x", D_symbol, D_symbol,
-               unsigned_immediate, D, unsigned_immediate, result);
-        D_write = true;
-        break;
-      case BV6(0, 0, 0, 1, 1, 0): // ANDI D i
-        result = D & unsigned_immediate;
-        INSTRUCTION("ANDI %s 0x%x", D_symbol, i);
-        ACTION("%s = %s & 0x%x = 0x%x & 0x%x = 0x%x", D_symbol, D_symbol,
-               unsigned_immediate, D, unsigned_immediate, result);
-        D_write = true;
-        break;
-      case BV6(0, 0, 1, 0, 1, 0): // SUB D i
-        address = unsigned_immediate;
-        loaded = M[address];
-        result = D - loaded;
-        INSTRUCTION("SUB %s %d", D_symbol, signed_immediate);
-        ACTION("%s = %s - M(<0x%x>) = %s - [0x%x] = %d - %d = %d = [0x%x]",
-               D_symbol, D_symbol, i, D_symbol, loaded, (int)D, (int)loaded,
-               (int)result, result);
-        D_write = true;
-        M_read = true;
-        break;
-      case BV6(0, 0, 1, 0, 1, 1): // ADD D i
-        address = unsigned_immediate;
-        loaded = M[address];
-        result = D + loaded;
-        INSTRUCTION("ADD %s %d", D_symbol, signed_immediate);
-        ACTION("%s = %s + M(<0x%x>) = %s + [0x%x] = %d + %d = %d = [0x%x]",
-               D_symbol, D_symbol, i, D_symbol, loaded, (int)D, (int)loaded,
-               (int)result, result);
-        D_write = true;
-        M_read = true;
-        break;
-      case BV6(0, 0, 1, 1, 0, 0): // OPLUS D i
-        address = unsigned_immediate;
-        loaded = M[address];
-        result = D ^ loaded;
-        INSTRUCTION("OPLUS %s 0x%x", D_symbol, i);
-        ACTION("%s = %s ^ M(<0x%x>) = 0x%x ^ 0x%x = 0x%x", D_symbol, D_symbol,
-               i, D, loaded, result);
-        D_write = true;
-        M_read = true;
-        break;
-      case BV6(0, 0, 1, 1, 0, 1): // OR D i
-        address = unsigned_immediate;
-        loaded = M[address];
-        result = D | loaded;
-        INSTRUCTION("OR %s 0x%x", D_symbol, i);
-        ACTION("%s = %s | M(<0x%x>) = 0x%x | 0x%x = 0x%x", D_symbol, D_symbol,
-               i, D, loaded, result);
-        D_write = true;
-        M_read = true;
-        break;
-      case BV6(0, 0, 1, 1, 1, 0): // AND D i
-        address = unsigned_immediate;
-        loaded = M[address];
-        result = D & loaded;
-        INSTRUCTION("AND %s 0x%x", D_symbol, i);
-        ACTION("%s = %s & M(<0x%x>) = 0x%x & 0x%x = 0x%x", D_symbol, D_symbol,
-               i, D, loaded, result);
-        D_write = true;
-        M_read = true;
-        break;
-      case BV6(0, 0, 0, 0, 0, 0):
-      case BV6(0, 0, 0, 0, 0, 1):
-      case BV6(0, 0, 0, 1, 1, 1):
-      case BV6(0, 0, 1, 0, 0, 0):
-      case BV6(0, 0, 1, 0, 0, 1):
-      case BV6(0, 0, 1, 1, 1, 1):
-        die("illegal instruction '0x%08x' at 'code[0x%08x]'", I, PC);
-        break;
+      memcpy(R, registers, sizeof registers);
+      memcpy(&taken, selected, sizeof taken);
+      active &= ~mask | taken;
+      mask = taken;
+    } break;
+    case LOADI:
+      R[D] = (mask & immediate) | (R[D] & ~mask);
+      break;
+    case MOVE:
+      R[D] = (mask & R[S]) | (R[D] & ~mask);
+      break;
+    case SUBI:
+      R[D] -= mask & immediate;
+      break;
+    case ADDI:
+      R[D] += mask & immediate;
+      break;
+    case OPLUSI:
+      R[D] ^= mask & immediate;
+      break;
+    case ORI:
+      R[D] |= mask & immediate;
+      break;
+    case ANDI:
+      R[D] &= ~mask | immediate;
+      break;
+    case NOP:
+      break;
+    case JUMPGT:
+      taken = mask & (lanes_word)(ACC > 0);
+      break;
+    case JUMPEQ:
+      taken = mask & (lanes_word)(ACC == 0);
+      break;
+    case JUMPGE:
+      taken = mask & (lanes_word)(ACC >= 0);
+      break;
+    case JUMPLT:
+      taken = mask & (lanes_word)(ACC < 0);
+      break;
+    case JUMPNE:
+      taken = mask & (lanes_word)(ACC != 0);
+      break;
+    case JUMPLE:
+      taken = mask & (lanes_word)(ACC <= 0);
+      break;
+    default:
+      assert(opcode == JUMP);
+      taken = mask;
+      break;
+    }
+    if (opcode < JUMPGT) {
+      R[PC_CODE] -= mask;
+      PC++;
+    } else {
+      if (!immediate) { // Self-loops are left to the exact engine.
+        active &= ~taken;
+        mask &= ~taken;
       }
-      break; // end of Compute Instructions
+      R[PC_CODE] += (taken & immediate) - (mask & ~taken);
+      search = true;
+    }
+    executed -= mask;
+    budget--;
+  }
 
-    case BV2(1, 1): // Jump Instructions
-      switch (I31to27) {
-      case BV5(1, 1, 0, 0, 0): // NOP
-        INSTRUCTION("NOP");
-        break;
-      case BV5(1, 1, 0, 0, 1): // JUMP> i
-        taken = ((int)ACC > 0);
-        comparison = taken ? ">" : "<=";
-        INSTRUCTION("JUMP> %d", signed_immediate);
-        break;
-      case BV5(1, 1, 0, 1, 0): // JUMP= i
-        taken = ((int)ACC == 0);
-        comparison = taken ? "=" : "!=";
-        INSTRUCTION("JUMP= %d", signed_immediate);
-        break;
-      case BV5(1, 1, 0, 1, 1): // JUMP>= i
-        taken = ((int)ACC >= 0);
-        comparison = taken ? ">=" : "<";
-        INSTRUCTION("JUMP>= %d", signed_immediate);
-        break;
-      case BV5(1, 1, 1, 0, 0): // JUMP< i
-        taken = ((int)ACC < 0);
-        comparison = taken ? "<" : ">=";
-        INSTRUCTION("JUMP< %d", signed_immediate);
-        break;
-      case BV5(1, 1, 1, 0, 1): // JUMP!= i
-        taken = ((int)ACC != 0);
-        comparison = taken ? "!=" : "=";
-        INSTRUCTION("JUMP!= %d", signed_immediate);
-        break;
-      case BV5(1, 1, 1, 1, 0): // JUMP<= i
-        taken = ((int)ACC <= 0);
-        comparison = taken ? "<=" : ">";
-        INSTRUCTION("JUMP<= %d", signed_immediate);
-        break;
-      case BV5(1, 1, 1, 1, 1): // JUMP i
-        taken = true;
-        INSTRUCTION("JUMP %d", signed_immediate);
-        break;
-      }
-      if (taken) {
-        PC_next = PC + signed_immediate;
-        if (comparison)
-          ACTION("PC = PC + [0x%x] = %u %c %d = %u = 0x%x "
-                 "as %d = [0x%x] = ACC %s 0",
-                 i, PC, immediate_sign_char, abs_immediate, PC_next, PC_next,
-                 (int)ACC, ACC, comparison);
-        else
-          ACTION("PC = PC + [0x%x] = %u %c %d = %u = 0x%x", i, PC,
-                 immediate_sign_char, abs_immediate, PC_next, PC_next);
-      } else if (comparison) {
-        assert(comparison);
-        assert(PC_next == PC + 1);
-        ACTION("no jump as %d = [0x%x] = ACC %s 0", ACC, ACC, comparison);
-      } else
-        ACTION("%s", "");
-      break; // end of Jump Instructions
+  for (size_t i = 0; i != size; i++) {
+    for (unsigned r = PC_CODE; r <= ACC_CODE; r++)
+      emulators[i]->reti.R[r] = R[r][i];
+    emulators[i]->steps = steps[i] + executed[i];
+  }
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+// In batch mode each data file is run on its own copy of the 'prototype'
+// emulator, which shares the loaded and decoded (and compiled) code.  The
+// runs are distributed in consecutive ranges over the workers.  Each worker
+// takes runs from the front of its range and, if it is empty, steals runs
+// from the end of the ranges of other workers.  The main thread prints the
+// results of the runs in input order as soon as they are done.  With
+// '--lanes=<n>' each worker takes up to 'n' runs at once, loads their data,
+// executes them in lockstep (see 'execute_lanes') and then finishes them
+// one after the other.
+
+struct worker {
+  pthread_t thread;
+  pthread_mutex_t lock;         // Protects 'begin' and 'end'.
+  size_t begin, end;            // Range of runs still to be done.
+  struct emulator emulators[MAX_LANES]; // Of the current runs.
+  struct batch *batch;
+};
+
+struct batch {
+  const struct emulator *prototype;
+  const char *output;           // Directory of dump files (if not zero).
+  struct run *runs;
+  size_t size;                  // Number of runs.
+  struct worker *workers;
+  size_t threads;               // Number of workers.
+  pthread_mutex_t lock;         // Protects 'done' of runs.
+  pthread_cond_t done;          // Signaled if a run is done.
+};
+
+// Get the next run of the worker, stealing one if its own range is empty.
+
+static struct run *next_run(struct worker *worker) {
+  struct batch *batch = worker->batch;
+  struct run *res = 0;
+  pthread_mutex_lock(&worker->lock);
+  if (worker->begin != worker->end)
+    res = batch->runs + worker->begin++;
+  pthread_mutex_unlock(&worker->lock);
+  const size_t self = worker - batch->workers;
+  for (size_t i = 1; !res && i != batch->threads; i++) {
+    struct worker *victim = batch->workers + (self + i) % batch->threads;
+    pthread_mutex_lock(&victim->lock);
+    if (victim->begin != victim->end)
+      res = batch->runs + --victim->end;
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return res;
+}
+
+
+// Open the output of the run and load its data into the emulator.  Returns
+// whether this succeeded, otherwise the run failed.
+
+static bool start_run(struct batch *batch, struct run *run,
+                      struct emulator *emulator) {
+  *emulator = *batch->prototype;
+  memset(&emulator->reti.data, 0, sizeof emulator->reti.data);
+  running = run;
+  if (!setjmp(run->abort)) {
+    if (batch->output) {
+      char *path = copy_path(batch->output, base_name(run->path), ".out");
+      run->output = fopen(path, "w");
+      if (!run->output)
+        die("can not write output file '%s'", path);
+      free(path);
     }
+    load_data(&emulator->reti.data, run->path);
+  } else {
+    run->failed = true;
+    if (run->input)
+      fclose(run->input);
+  }
+  running = 0;
+  return !run->failed;
+}
 
-#ifndef NSTEPPING
-    if (step) {
-      if (steps == 1) {
-        fputs("STEPS    PC       CODE     IN1      IN2      ACC      ", stdout);
-        printf(instruction_format, "INSTRUCTION");
-        fputs(" ACTION\n", stdout);
-      }
-      printf("%-8zu %08x %08x %08x %08x %08x ", steps, PC, I, IN1, IN2, ACC);
-      printf(instruction_format, instruction);
-#ifndef NDEBUG
-      char instruction2[32];
-      disassemble_reti_code(I, instruction2);
+// Emulate the (started) run until it stops, print its data memory and
+// signal that it is done.
+
+static void finish_run(struct batch *batch, struct run *run,
+                       struct emulator *emulator) {
+  if (!run->failed) {
+    running = run;
+    if (!setjmp(run->abort)) {
+      emulate(emulator);
+      print_memory(&emulator->reti.data, run->output);
+    } else
+      run->failed = true;
+    running = 0;
+  }
+  release_memory(&emulator->reti.data);
+  if (run->output)
+    fclose(run->output);
+  fclose(run->messages);
+  pthread_mutex_lock(&batch->lock);
+  run->done = true;
+  pthread_cond_broadcast(&batch->done);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+static void execute_runs(struct worker *worker, struct run **runs,
+                         size_t size) {
+  struct emulator *emulators[MAX_LANES];
+  size_t started = 0;
+  for (size_t i = 0; i != size; i++)
+    if (start_run(worker->batch, runs[i], worker->emulators + i))
+      emulators[started++] = worker->emulators + i;
+#ifdef LOCKSTEP
+  if (started > 1)
+    execute_lanes(emulators, started);
+#else
+  (void)emulators;
 #endif
-      fputc(' ', stdout);
-      fputs(action, stdout);
-      fputc('\n', stdout);
-      fflush(stdout);
-#ifndef NDEBUG
-      if (strcmp(instruction, instruction2)) {
-        fprintf(stderr,
-                "emreti: fatal: "
-                "disassambled instruction '%s' does not match\n",
-                instruction2);
-        fflush(stderr);
-        abort();
-      }
+  for (size_t i = 0; i != size; i++)
+    finish_run(worker->batch, runs[i], worker->emulators + i);
+}
+
+static void *work(void *ptr) {
+  struct worker *worker = ptr;
+  struct run *runs[MAX_LANES];
+  size_t size;
+  do {
+    size = 0;
+    while (size != lanes && (runs[size] = next_run(worker)))
+      size++;
+    execute_runs(worker, runs, size);
+  } while (size);
+  return 0;
+}
+
+// Run the prototype emulator on all data files in 'paths' with 'threads'
+// workers.  Returns the number of failed runs.
+
+static size_t run_batch(const struct emulator *prototype, const char **paths,
+                        size_t size, size_t threads, const char *output) {
+  struct batch batch;
+  batch.prototype = prototype;
+  batch.output = output;
+  batch.size = size;
+  batch.threads = threads < size ? threads : size;
+  batch.runs = calloc(size, sizeof *batch.runs);
+  batch.workers = calloc(batch.threads, sizeof *batch.workers);
+  if (!batch.runs || !batch.workers)
+    die("can not allocate batch");
+  pthread_mutex_init(&batch.lock, 0);
+  pthread_cond_init(&batch.done, 0);
+
+  for (size_t i = 0; i != size; i++) {
+    struct run *run = batch.runs + i;
+    run->path = paths[i];
+    run->messages =
+        open_memstream(&run->messages_buffer, &run->messages_bytes);
+    if (!output)
+      run->output = open_memstream(&run->output_buffer, &run->output_bytes);
+    if (!run->messages || (!output && !run->output))
+      die("can not allocate output buffers");
+  }
+
+  for (size_t i = 0; i != batch.threads; i++) {
+    struct worker *worker = batch.workers + i;
+    worker->batch = &batch;
+    worker->begin = i * size / batch.threads;
+    worker->end = (i + 1) * size / batch.threads;
+    pthread_mutex_init(&worker->lock, 0);
+  }
+  for (size_t i = 0; i != batch.threads; i++)
+    if (pthread_create(&batch.workers[i].thread, 0, work, batch.workers + i))
+      die("can not create worker thread");
+
+  size_t failed = 0;
+  for (size_t i = 0; i != size; i++) {
+    struct run *run = batch.runs + i;
+    pthread_mutex_lock(&batch.lock);
+    while (!run->done)
+      pthread_cond_wait(&batch.done, &batch.lock);
+    pthread_mutex_unlock(&batch.lock);
+    fwrite(run->messages_buffer, 1, run->messages_bytes, stderr);
+    free(run->messages_buffer);
+    if (!output) {
+      printf("; %s\n", run->path);
+      fwrite(run->output_buffer, 1, run->output_bytes, stdout);
+      free(run->output_buffer);
+    }
+    failed += run->failed;
+  }
+
+  for (size_t i = 0; i != batch.threads; i++)
+    pthread_join(batch.workers[i].thread, 0);
+  for (size_t i = 0; i != batch.threads; i++)
+    pthread_mutex_destroy(&batch.workers[i].lock);
+  pthread_cond_destroy(&batch.done);
+  pthread_mutex_destroy(&batch.lock);
+  free(batch.workers);
+  free(batch.runs);
+  return failed;
+}
+
+//----------------------------------------------------------------------------//
+
+// Loading code and data as well as printing the final data memory is done
+// in the main function.
+
+int main(int argc, char **argv) {
+
+  //--------------------------------------------------------------------------//
+  // First parse command line options.
+
+  bool force = 0;
+  bool batch = false;
+
+  const char *code_path = 0;
+  const char *data_path = 0;
+  const char *limit_string = 0;
+  const char *threads_string = 0;
+  const char *output_directory = 0;
+  const char *lanes_string = 0;
+  const char *window_string = 0;
+  const char *recorder_string = 0;
+
+  const char **more_data_paths = malloc(argc * sizeof *more_data_paths);
+  size_t size_more_data_paths = 0;
+  if (!more_data_paths)
+    die("can not allocate data paths");
+
+  for (int i = 1; i != argc; i++) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+      fputs(usage, stdout);
+      exit(0);
+    } else if (!strcmp(arg, "-s") || !strcmp(arg, "--step")) {
+      step = true;
+    } else if (!strcmp(arg, "-j") || !strcmp(arg, "--jit")) {
+#ifdef JIT
+      just_in_time = true;
+#else
+      die("invalid option '%s' "
+          "(configured and compiled without JIT support)",
+          arg);
+#endif
+    } else if (!strcmp(arg, "-g") || !strcmp(arg, "--debug"))
+      debug = 1;
+    else if (!strcmp(arg, "-i") || !strcmp(arg, "--ignore"))
+      debug = -1;
+    else if (!strcmp(arg, "-f") || !strcmp(arg, "--force"))
+      force = true;
+    else if (!strcmp(arg, "-b") || !strcmp(arg, "--batch"))
+      batch = true;
+    else if (!strcmp(arg, "--no-fuse"))
+      fusing = false;
+    else if (!strncmp(arg, "--threads=", 10)) {
+      threads_string = arg + 10;
+      if (!is_number_string(threads_string) || strlen(threads_string) > 4 ||
+          !atoi(threads_string))
+        die("invalid number of threads in '%s'", arg);
+    } else if (!strncmp(arg, "--lanes=", 8)) {
+#ifdef LOCKSTEP
+      lanes = atoi(arg + 8);
+      if (!is_number_string(arg + 8) || strlen(arg + 8) > 2 || !lanes ||
+          lanes > MAX_LANES)
+        die("invalid number of lanes in '%s'", arg);
+      lanes_string = arg;
+#else
+      die("invalid option '%s' (compiled without lockstep support)", arg);
+#endif
+    } else if (!strncmp(arg, "--trace=", 8)) {
+      trace.path = arg + 8;
+      if (!*trace.path)
+        die("empty trace file in '%s'", arg);
+    } else if (!strncmp(arg, "--trace-from=", 13)) {
+      trace_from = parse_number(arg, arg + 13, ~(size_t)0);
+      if (!trace_from)
+        die("invalid first step in '%s' (steps start at 1)", arg);
+      window_string = arg;
+    } else if (!strncmp(arg, "--trace-to=", 11)) {
+      trace_to = parse_number(arg, arg + 11, ~(size_t)0);
+      window_string = arg;
+    } else if (!strncmp(arg, "--trace-pc=", 11)) {
+      const char *hi = strchr(arg + 11, '-');
+      if (!hi)
+        die("expected '<lo>-<hi>' in '%s'", arg);
+      char lo[24];
+      if ((size_t)(hi - (arg + 11)) >= sizeof lo)
+        die("invalid 'PC' in '%s'", arg);
+      memcpy(lo, arg + 11, hi - (arg + 11));
+      lo[hi - (arg + 11)] = 0;
+      trace_lo = parse_number(arg, lo, ~0u);
+      trace_hi = parse_number(arg, hi + 1, ~0u);
+      window_string = arg;
+    } else if (!strncmp(arg, "--profile=", 10)) {
+      profile.path = arg + 10;
+      if (!*profile.path)
+        die("empty profile file in '%s'", arg);
+    } else if (!strcmp(arg, "--profile-hot"))
+      profile.hot = true;
+    else if (!strcmp(arg, "--stats"))
+      statistics = true;
+    else if (!strncmp(arg, "--sample=", 9)) {
+      sample.rate = parse_number(arg, arg + 9, 100000);
+      if (!sample.rate)
+        die("invalid sampling rate in '%s'", arg);
+      sampling = true;
+    } else if (!strncmp(arg, "--sample-folded=", 16)) {
+      sample.folded = arg + 16;
+      if (!*sample.folded)
+        die("empty folded samples file in '%s'", arg);
+    } else if (!strcmp(arg, "--hw-counters")) {
+#ifdef PERF
+      hardware = true;
+#else
+      die("invalid option '%s' "
+          "(configured and compiled without hardware counters)",
+          arg);
+#endif
+    } else if (!strncmp(arg, "--recorder=", 11)) {
+      recorder.size = parse_number(arg, arg + 11, 1u << 24);
+      recorder_string = arg;
+    } else if (!strncmp(arg, "--output=", 9)) {
+      output_directory = arg + 9;
+      if (!*output_directory)
+        die("empty output directory in '%s'", arg);
+    } else if (arg[0] == '-' && arg[1])
+      die("invalid option '%s' (try '-h')", arg);
+    else if (is_number_string(arg)) {
+      if (limit_string)
+        die("two steps limits '%s' and '%s'", limit_string, arg);
+      if (file_exists(arg))
+        die("steps limit '%s' matches file '%s'", arg, arg);
+      limit_string = arg;
+    } else if (!code_path)
+      code_path = arg;
+    else if (!data_path)
+      data_path = arg;
+    else
+      more_data_paths[size_more_data_paths++] = arg;
+  }
+
+  if (!batch && size_more_data_paths)
+    die("more than two files specified '%s', '%s' and '%s' (try '-h')",
+        code_path, data_path, more_data_paths[0]);
+
+  struct paths paths = {0, 0, 0}; // Data files in batch mode.
+  size_t threads = 0;
+  if (batch) {
+    if (step)
+      die("can not combine stepping with batch mode");
+    if (trace.path)
+      die("can not combine tracing with batch mode");
+    if (recorder_string && recorder.size)
+      die("can not combine '%s' with batch mode", recorder_string);
+    recorder.size = 0;
+    if (profile.path || statistics)
+      die("can not combine profiling or statistics with batch mode");
+#ifdef PERF
+    if (hardware)
+      die("can not combine hardware counters with batch mode");
 #endif
+    if (sampling)
+      die("can not combine sampling with batch mode");
+    if (!data_path)
+      die("no data files specified in batch mode");
+    add_data_files(&paths, data_path);
+    for (size_t i = 0; i != size_more_data_paths; i++)
+      add_data_files(&paths, more_data_paths[i]);
+    for (size_t i = 0; i != paths.size; i++)
+      if (!strcmp(paths.start[i], "-"))
+        die("can not read data from '<stdin>' in batch mode");
+    if (output_directory)
+      check_output_names(&paths);
+    if (threads_string)
+      threads = atoi(threads_string);
+    else {
+      const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = processors > 0 ? processors : 1;
     }
+  } else if (threads_string || output_directory || lanes_string)
+    die("'--threads', '--output' and '--lanes' require '--batch'");
+  free(more_data_paths);
+
+  if (window_string && !step && !trace.path)
+    die("'%s' requires '--step' or '--trace'", window_string);
+  if (trace_from > trace_to)
+    die("empty steps range from '%zu' to '%zu'", trace_from, trace_to);
+  if (trace_lo > trace_hi)
+    die("empty 'PC' range from '0x%x' to '0x%x'", trace_lo, trace_hi);
+  if (step || trace.path) {
+    if (recorder_string && recorder.size)
+      die("can not combine '%s' with stepping or tracing", recorder_string);
+    recorder.size = 0;
+  }
+  if (profile.hot && !profile.path)
+    die("'--profile-hot' requires '--profile'");
+  if (sample.folded && !sampling)
+    die("'--sample-folded' requires '--sample'");
+#ifdef JIT
+  if ((profile.path || statistics) && just_in_time)
+    die("can not combine profiling or statistics with '--jit'");
 #endif
+  if ((profile.path || statistics) && (trace_lo || trace_hi != ~0u))
+    die("can not combine profiling or statistics with '--trace-pc'");
+  if (recorder.size) {
+    while (recorder.mask < recorder.size)
+      recorder.mask = 2 * recorder.mask + 1;
+    recorder.ring = malloc((recorder.mask + 1) * sizeof *recorder.ring);
+    if (!recorder.ring)
+      die("can not allocate recorder");
+  }
 
-    if (M_read) {
-      if (address >= shadow.data || !shadow.valid[address]) {
-        if (debug > 0) {
-          warn("stopping on reading uninitialized 'data[0x%x]'", address);
-          break;
-        }
-        if (!debug)
-          warn("continuing after reading uninitialized 'data[0x%x]' "
-               "(use '-i' so squelch such messages, or '-g' to stop)",
-               address);
-      }
+  const size_t max_limit = ~(size_t)0;
+  if (limit_string) {
+    limit = 0;
+    const char *p = limit_string;
+    int ch;
+    while ((ch = *p++)) {
+      assert(isdigit(ch));
+      if (max_limit / 10 < limit)
+        die("maximum steps limit exceeded in '%s'", limit_string);
+      limit *= 10;
+      int digit = ch - '0';
+      if (max_limit - digit < limit)
+        die("maximum steps limit exceeded in '%s'", limit_string);
+      limit += digit;
     }
+  }
 
-    assert(!D_write || !M_write);
+  select_emulation();
 
-    // First write result to register if written.
+  if (code_path && data_path)
+    if (!strcmp(code_path, "-") && !strcmp(data_path, "-"))
+      die("can not read both code and data from '<stdin>'");
 
-    if (D_write) {
+  //--------------------------------------------------------------------------//
 
-      *D_pointer = result;
+  struct emulator emulator;
+  struct reti *reti = &emulator.reti;
+  struct shadow *shadow = &emulator.shadow;
 
-      if (D_pointer == &reti.PC)
-        PC_next = result;
-    }
+  reti->PC = reti->ACC = reti->IN1 = reti->IN2 = 0;
+  emulator.steps = 0;
+  emulator.uninitialized = 0;
 
-    // Then write result to memory if written.
+  //--------------------------------------------------------------------------//
 
-    if (M_write) {
+  // Code memory grows while reading and data pages are allocated lazily.
 
-      if ((size_t)address >= (size_t)CAPACITY)
-        die("can not write 'data[0x%x]' above address 0x%x", address,
-            (unsigned)(CAPACITY - 1));
+  size_t capacity_code = 0;
+  bool mapped_code = false;
+  reti->code = 0;
+  shadow->code = 0;
 
-      // Written data becomes valid.
+  memset(&reti->data, 0, sizeof reti->data);
 
-      if (!shadow.valid[address]) {
-        shadow.valid[address] = true;
-        if (address >= shadow.data)
-          shadow.data = 1 + (size_t)address;
-      }
+  // Read code file.
 
-      M[address] = result;
+  phase_started = wall_clock_time();
+  {
+    FILE *code_file = 0;
+    bool close_code_file = false;
+    if (!code_path || !strcmp(code_path, "-"))
+      code_path = "<stdin>", code_file = stdin;
+    else if (!file_exists(code_path))
+      die("code file '%s' does not exist", code_path);
+    else if (!(code_file = fopen(code_path, "r")))
+      die("can not read code file '%s'", code_path);
+    else
+      close_code_file = true;
+    struct parser parser;
+    init_parser(&parser, code_file, code_path);
+#ifdef MMAP
+    if (close_code_file)
+      reti->code = map_file(code_file, PROT_READ, &shadow->code);
+    if (reti->code) {
+      if (shadow->code > CAPACITY)
+        die("capacity of code area reached");
+      mapped_parser(&parser, reti->code, shadow->code);
+      mapped_code = true;
     }
-
-    if (PC_next == PC) { // Check if stuck in infinite loop.
-#ifndef NSTEPPING
-      if (step) {
-        if (steps == 1)
-          fputs("STEPS   PC       CODE     IN1      IN2      ACC\n", stdout);
-        printf("%-8zu %08x %08x %08x %08x %08x <infinite-loop>\n", steps, PC, I,
-               IN1, IN2, ACC);
-      }
 #endif
-      break;
+    unsigned code;
+    while (!mapped_code && next_word(&parser, &code)) {
+      if (shadow->code == capacity_code) {
+        if (capacity_code == CAPACITY)
+          die("capacity of code area reached");
+        capacity_code = capacity_code ? 2 * capacity_code : 1024;
+        reti->code = realloc(reti->code, capacity_code * sizeof *reti->code);
+        if (!reti->code)
+          die("can not allocate code");
+      }
+      reti->code[shadow->code++] = code;
+    }
+    if (!force && parser.words && !parser.binary) {
+      const char *magic = "; ranreti ";
+      const size_t magic_len = strlen(magic);
+      const size_t compare_len =
+          magic_len < parser.bytes ? magic_len : parser.bytes;
+      if (!strncmp(magic, (char *)reti->code, compare_len))
+        die("non-binary '%s' looks like an assembler file and not machine code "
+            "(use '-f' to force reading)",
+            code_path);
+      else if (parser.words > 2)
+        die("non-binary '%s' with %zu words does not look like machine code "
+            "(use '-f' to force reading)",
+            code_path, parser.words);
+      else
+        warn("non-binary '%s' with %s does not look like machine code "
+             "(use '-f' to squelch this warning)",
+             code_path, parser.words == 1 ? "one word" : "two words");
+    }
+    if (close_code_file)
+      fclose(code_file);
+    if (step || trace.path || recorder.size) {
+      char instruction[disassembled_reti_code_length];
+      for (size_t i = 0; i != shadow->code; i++) {
+        const unsigned code = reti->code[i];
+        if (reti_opcode(code) == ILLEGAL)
+          continue;
+        size_t length = format_reti_code(code, instruction);
+        if (length > instruction_length)
+          instruction_length = length;
+      }
     }
+    if (trace.path)
+      open_trace();
+  }
+  end_phase(CODE_LOAD);
+
+  // Decode all code words once.
+
+  reti->decoded = decode_code(reti->code, shadow->code);
+  if (!reti->decoded)
+    die("can not allocate decoded code");
+  if (fusing)
+    fuse_code(reti->decoded, shadow->code);
+  execute_fast(0, reti->decoded, shadow->code);
+  if (trace_lo || trace_hi != ~0u) {
+    traced = decode_traced(reti->code, shadow->code);
+    if (!traced)
+      die("can not allocate decoded code");
+  }
+  if (profile.path || statistics) {
+    counters = calloc(shadow->code + 1, sizeof *counters);
+    if (!counters)
+      die("can not allocate profile counters");
+    profile.code = reti->code;
+    profile.decoded = reti->decoded;
+    profile.size = shadow->code;
+    atexit(write_profile);
+  }
+  if (sampling) {
+    sample.histogram = calloc(shadow->code + 1, sizeof *sample.histogram);
+    if (!sample.histogram)
+      die("can not allocate samples");
+    sample.program =
+        code_path && strcmp(code_path, "-") ? code_path : "<stdin>";
+    sample.code = reti->code;
+    sample.size = shadow->code;
+    atexit(print_samples);
+  }
+  recorder.code = reti->code;
+  recorder.size_code = shadow->code;
+  end_phase(ALLOCATION);
 
-    // Finally update PC.
+  // Read data file (in batch mode each run reads its own data file).
 
-    reti.PC = PC_next;
-  }
+  if (data_path && !batch)
+    load_data(&reti->data, data_path);
+  end_phase(DATA_LOAD);
 
-#ifndef NSTEPPING
-  if (step)
-    fputs("ADDRESS  DATA     BYTES       "
-          "ASCII  UNSIGNED       SIGNED\n",
-          stdout);
-#endif
-
-  for (size_t i = 0; i != shadow.data; i++)
-    if (shadow.valid[i]) {
-      const unsigned word = reti.data[i];
-      printf("%08x %08x", (unsigned)i, word);
-#ifndef NSTEPPING
-      if (step) {
-        for (unsigned i = 0, tmp = word; i != 4; i++, tmp >>= 8)
-          printf(" %02x", tmp & 0xff);
-        fputs(" ", stdout);
-        for (unsigned i = 0, tmp = word; i != 4; i++, tmp >>= 8) {
-          int ch = tmp & 0xff;
-          printf("%c", isprint(ch) ? ch : '.');
-        }
-        printf("%11u %12d", (unsigned)word, (int)word);
-      }
+  // The compiled code depends on whether there is a data image, which in
+  // batch mode is only known per run.
+
+#ifdef JIT
+  if (just_in_time &&
+      !compile(reti->decoded, shadow->code, batch || reti->data.image))
+    warn("can not compile program (falling back to interpretation)");
+  end_phase(ALLOCATION);
+#endif
+
+#ifdef PERF
+  if (hardware)
+    open_hardware_counters();
 #endif
-      fputc('\n', stdout);
-    }
 
-  free(shadow.valid);
-  free(reti.data);
-  free(reti.code);
+  //--------------------------------------------------------------------------//
 
-  return 0;
+  // Simulate code on data (or on all data files in batch mode).
+
+  int res = 0;
+
+  if (batch) {
+    if (run_batch(&emulator, (const char **)paths.start, paths.size, threads,
+                  output_directory))
+      res = 1;
+    for (size_t i = 0; i != paths.size; i++)
+      free(paths.start[i]);
+    free(paths.start);
+  } else {
+    if (step)
+      start_printer();
+#ifdef PERF
+    enable_hardware_counters();
+#endif
+    start_recording();
+    start_sampling();
+    emulate(&emulator);
+    stop_sampling();
+#ifdef PERF
+    disable_hardware_counters();
+#endif
+    stop_printer();
+    end_phase(EXECUTION);
+    write_profile();
+    print_memory(&reti->data, stdout);
+    end_phase(DUMP);
+    if (statistics)
+      print_statistics(&emulator);
+#ifdef PERF
+    print_hardware_counters(emulator.steps < limit ? emulator.steps : limit);
+#endif
+    print_samples();
+    release_memory(&reti->data);
+  }
+
+#ifdef JIT
+  release_jit();
+#endif
+  free(reti->decoded);
+  free(traced);
+  free(recorder.ring);
+  free(counters);
+  free((void *)sample.histogram);
+#ifdef MMAP
+  if (mapped_code)
+    munmap(reti->code, shadow->code * sizeof *reti->code);
+  else
+#endif
+    free(reti->code);
+
+  return res;
 }
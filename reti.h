@@ -0,0 +1,133 @@
+#ifndef _reti_h_INCLUDED
+#define _reti_h_INCLUDED
+
+#include <string.h>
+
+// The instruction set of ReTI in one table, from which all tools derive
+// their opcodes, decoding, assembling and disassembling.
+//
+// Each instruction is determined by a prefix of the six most significant
+// bits of its code word.  An 'OPCODE' entry gives the name of the opcode,
+// its mnemonic, the number of bits of the prefix, the prefix as six bits
+// (where the bits after the prefix are zero), the operands and how the
+// immediate is interpreted.  The operands are either 'S_D' (only 'MOVE'),
+// 'D_I', 'I' or 'NONE'.  Immediates are either 'UNSIGNED', 'SIGNED' (thus
+// sign-extended), 'HEXADECIMAL' (unsigned but printed as hexadecimal) or
+// 'ADDRESS' (unsigned but printed as signed number for historical reasons).
+// Immediates of instructions without 'I' operand are not used.
+//
+// The remaining 6-bit prefixes do not belong to any instruction and are
+// listed as 'ILLEGAL' entries, such that all 64 prefixes are covered.
+
+// clang-format off
+
+#define RETI_OPCODES \
+OPCODE(LOAD,     "LOAD",     4, RETI_PREFIX(0,1,0,0,0,0), D_I,  UNSIGNED)    \
+OPCODE(LOADIN1,  "LOADIN1",  4, RETI_PREFIX(0,1,0,1,0,0), D_I,  SIGNED)      \
+OPCODE(LOADIN2,  "LOADIN2",  4, RETI_PREFIX(0,1,1,0,0,0), D_I,  SIGNED)      \
+OPCODE(LOADI,    "LOADI",    4, RETI_PREFIX(0,1,1,1,0,0), D_I,  UNSIGNED)    \
+OPCODE(STORE,    "STORE",    4, RETI_PREFIX(1,0,0,0,0,0), I,    UNSIGNED)    \
+OPCODE(STOREIN1, "STOREIN1", 4, RETI_PREFIX(1,0,0,1,0,0), I,    SIGNED)      \
+OPCODE(STOREIN2, "STOREIN2", 4, RETI_PREFIX(1,0,1,0,0,0), I,    SIGNED)      \
+OPCODE(MOVE,     "MOVE",     4, RETI_PREFIX(1,0,1,1,0,0), S_D,  UNSIGNED)    \
+OPCODE(SUBI,     "SUBI",     6, RETI_PREFIX(0,0,0,0,1,0), D_I,  SIGNED)      \
+OPCODE(ADDI,     "ADDI",     6, RETI_PREFIX(0,0,0,0,1,1), D_I,  SIGNED)      \
+OPCODE(OPLUSI,   "OPLUSI",   6, RETI_PREFIX(0,0,0,1,0,0), D_I,  HEXADECIMAL) \
+OPCODE(ORI,      "ORI",      6, RETI_PREFIX(0,0,0,1,0,1), D_I,  HEXADECIMAL) \
+OPCODE(ANDI,     "ANDI",     6, RETI_PREFIX(0,0,0,1,1,0), D_I,  HEXADECIMAL) \
+OPCODE(SUB,      "SUB",      6, RETI_PREFIX(0,0,1,0,1,0), D_I,  ADDRESS)     \
+OPCODE(ADD,      "ADD",      6, RETI_PREFIX(0,0,1,0,1,1), D_I,  ADDRESS)     \
+OPCODE(OPLUS,    "OPLUS",    6, RETI_PREFIX(0,0,1,1,0,0), D_I,  HEXADECIMAL) \
+OPCODE(OR,       "OR",       6, RETI_PREFIX(0,0,1,1,0,1), D_I,  HEXADECIMAL) \
+OPCODE(AND,      "AND",      6, RETI_PREFIX(0,0,1,1,1,0), D_I,  HEXADECIMAL) \
+OPCODE(NOP,      "NOP",      5, RETI_PREFIX(1,1,0,0,0,0), NONE, SIGNED)      \
+OPCODE(JUMPGT,   "JUMP>",    5, RETI_PREFIX(1,1,0,0,1,0), I,    SIGNED)      \
+OPCODE(JUMPEQ,   "JUMP=",    5, RETI_PREFIX(1,1,0,1,0,0), I,    SIGNED)      \
+OPCODE(JUMPGE,   "JUMP>=",   5, RETI_PREFIX(1,1,0,1,1,0), I,    SIGNED)      \
+OPCODE(JUMPLT,   "JUMP<",    5, RETI_PREFIX(1,1,1,0,0,0), I,    SIGNED)      \
+OPCODE(JUMPNE,   "JUMP!=",   5, RETI_PREFIX(1,1,1,0,1,0), I,    SIGNED)      \
+OPCODE(JUMPLE,   "JUMP<=",   5, RETI_PREFIX(1,1,1,1,0,0), I,    SIGNED)      \
+OPCODE(JUMP,     "JUMP",     5, RETI_PREFIX(1,1,1,1,1,0), I,    SIGNED)
+
+#define RETI_ILLEGAL_PREFIXES \
+ILLEGAL_PREFIX(RETI_PREFIX(0,0,0,0,0,0)) \
+ILLEGAL_PREFIX(RETI_PREFIX(0,0,0,0,0,1)) \
+ILLEGAL_PREFIX(RETI_PREFIX(0,0,0,1,1,1)) \
+ILLEGAL_PREFIX(RETI_PREFIX(0,0,1,0,0,0)) \
+ILLEGAL_PREFIX(RETI_PREFIX(0,0,1,0,0,1)) \
+ILLEGAL_PREFIX(RETI_PREFIX(0,0,1,1,1,1))
+
+// clang-format on
+
+#define RETI_PREFIX(A, B, C, D, E, F)                                          \
+  (((A) << 5) | ((B) << 4) | ((C) << 3) | ((D) << 2) | ((E) << 1) | (F))
+
+// The opcodes in the order of the table with 'ILLEGAL' last.
+
+enum opcode {
+#define OPCODE(NAME, ...) NAME,
+  RETI_OPCODES
+#undef OPCODE
+  ILLEGAL
+};
+
+enum reti_operands { RETI_S_D, RETI_D_I, RETI_I, RETI_NONE };
+
+enum reti_immediate {
+  RETI_UNSIGNED,
+  RETI_SIGNED,
+  RETI_HEXADECIMAL,
+  RETI_ADDRESS,
+};
+
+struct reti_instruction {
+  const char *mnemonic;
+  unsigned char length;    // Of 'mnemonic'.
+  unsigned char bits;      // Of 'prefix'.
+  unsigned char prefix;    // Six most significant bits of the code word.
+  unsigned char operands;  // Actually an 'enum reti_operands'.
+  unsigned char immediate; // Actually an 'enum reti_immediate'.
+};
+
+static const struct reti_instruction reti_instructions[] = {
+#define OPCODE(NAME, MNEMONIC, BITS, PREFIX, OPERANDS, IMMEDIATE)              \
+  [NAME] = {MNEMONIC, sizeof MNEMONIC - 1, BITS, PREFIX, RETI_##OPERANDS,      \
+            RETI_##IMMEDIATE},
+    RETI_OPCODES
+#undef OPCODE
+    [ILLEGAL] = {"ILLEGAL", 7, 0, 0, RETI_NONE, RETI_UNSIGNED},
+};
+
+// Maps the six most significant bits of a code word to its opcode.  Each
+// instruction occupies all the prefixes starting with its (shorter) prefix.
+
+static const unsigned char reti_decoding[64] = {
+#define OPCODE(NAME, MNEMONIC, BITS, PREFIX, ...)                              \
+  [PREFIX ... PREFIX + (1 << (6 - BITS)) - 1] = NAME,
+    RETI_OPCODES
+#undef OPCODE
+#define ILLEGAL_PREFIX(PREFIX) [PREFIX] = ILLEGAL,
+    RETI_ILLEGAL_PREFIXES
+#undef ILLEGAL_PREFIX
+};
+
+static inline enum opcode reti_opcode(unsigned code) {
+  return (enum opcode)reti_decoding[code >> 26];
+}
+
+// The code word of the opcode with all operands zero.
+
+static inline unsigned reti_code(enum opcode opcode) {
+  return (unsigned)reti_instructions[opcode].prefix << 26;
+}
+
+// Find the opcode of a mnemonic (returns 'ILLEGAL' if there is none).
+
+static inline enum opcode reti_mnemonic(const char *mnemonic) {
+  for (unsigned i = 0; i != ILLEGAL; i++)
+    if (!strcmp(reti_instructions[i].mnemonic, mnemonic))
+      return (enum opcode)i;
+  return ILLEGAL;
+}
+
+#endif
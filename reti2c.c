@@ -0,0 +1,649 @@
+// clang-format off
+
+static const char * usage =
+"usage: reti2c [ -h | --help ] [ <code> [ <c-file> ] ]\n"
+"\n"
+"Translates the ReTI machine code '<code>' into a standalone C program,\n"
+"with one label per instruction, which produces exactly the same output\n"
+"as 'emreti' running '<code>' (without stepping).  Compile the result with\n"
+"for instance 'gcc -O3 -o program <c-file>' and run it as\n"
+"\n"
+"  program [ -g | -i ] [ <steps> ] [ <data> ]\n"
+"\n"
+"If '<code>' is missing or '-' the code is read from '<stdin>' and if\n"
+"'<c-file>' is missing or '-' the C program is written to '<stdout>'.\n"
+;
+
+// The part of the generated program which does not depend on the code.
+// It follows 'emreti.c' closely and produces the same messages.
+
+static const char * header =
+"#include <ctype.h>\n"
+"#include <stdarg.h>\n"
+"#include <stdbool.h>\n"
+"#include <stdio.h>\n"
+"#include <stdlib.h>\n"
+"#include <string.h>\n"
+"\n"
+"#include <sys/stat.h>\n"
+"#include <sys/types.h>\n"
+"#include <unistd.h>\n"
+"\n"
+"#define CAPACITY ((size_t)1 << 32)\n"
+"\n"
+"#define LOG_PAGE_SIZE 12\n"
+"#define LOG_TABLE_SIZE 10\n"
+"\n"
+"#define PAGE_SIZE ((size_t)1 << LOG_PAGE_SIZE)\n"
+"#define TABLE_SIZE ((size_t)1 << LOG_TABLE_SIZE)\n"
+"\n"
+"#define TABLE_INDEX(ADDRESS) ((ADDRESS) >> (LOG_PAGE_SIZE + LOG_TABLE_SIZE))\n"
+"#define PAGE_INDEX(ADDRESS) (((ADDRESS) >> LOG_PAGE_SIZE) & (TABLE_SIZE - 1))\n"
+"#define WORD_INDEX(ADDRESS) ((ADDRESS) & (PAGE_SIZE - 1))\n"
+"\n"
+"static void die(const char *, ...) __attribute__((format(printf, 1, 2)));\n"
+"\n"
+"static void die(const char *fmt, ...) {\n"
+"  fflush(stdout);\n"
+"  fputs(\"emreti: error: \", stderr);\n"
+"  va_list ap;\n"
+"  va_start(ap, fmt);\n"
+"  vfprintf(stderr, fmt, ap);\n"
+"  va_end(ap);\n"
+"  fputc('\\n', stderr);\n"
+"  exit(1);\n"
+"}\n"
+"\n"
+"static void warn(const char *, ...) __attribute__((format(printf, 1, 2)));\n"
+"\n"
+"static void warn(const char *fmt, ...) {\n"
+"  fflush(stdout);\n"
+"  fputs(\"emreti: warning: \", stderr);\n"
+"  va_list ap;\n"
+"  va_start(ap, fmt);\n"
+"  vfprintf(stderr, fmt, ap);\n"
+"  va_end(ap);\n"
+"  fputc('\\n', stderr);\n"
+"  fflush(stderr);\n"
+"}\n"
+"\n"
+"static bool file_exists(const char *path) {\n"
+"  struct stat buf;\n"
+"  return !stat(path, &buf);\n"
+"}\n"
+"\n"
+"static bool is_number_string(const char *str) {\n"
+"  if (!isdigit(*str))\n"
+"    return false;\n"
+"  for (const char *p = str + 1; *p; p++)\n"
+"    if (!isdigit(*p))\n"
+"      return false;\n"
+"  return true;\n"
+"}\n"
+"\n"
+"static size_t words, bytes;\n"
+"static const char *data_path;\n"
+"static FILE *data_file;\n"
+"\n"
+"static void error(const char *, ...) __attribute((format(printf, 1, 2)));\n"
+"\n"
+"static void error(const char *fmt, ...) {\n"
+"  fprintf(stderr, \"emreti: parse error: in word %zu after %zu bytes in '%s': \",\n"
+"          words, bytes, data_path);\n"
+"  va_list ap;\n"
+"  va_start(ap, fmt);\n"
+"  vfprintf(stderr, fmt, ap);\n"
+"  va_end(ap);\n"
+"  fputc('\\n', stderr);\n"
+"  exit(1);\n"
+"}\n"
+"\n"
+"static int next_char(void) {\n"
+"  int res = getc(data_file);\n"
+"  if (res != EOF)\n"
+"    bytes++;\n"
+"  return res;\n"
+"}\n"
+"\n"
+"static bool next_word(unsigned *word_ptr) {\n"
+"  int ch = next_char();\n"
+"  if (ch == EOF)\n"
+"    return false;\n"
+"  words++;\n"
+"  unsigned word = (unsigned char)ch;\n"
+"  if ((ch = next_char()) == EOF)\n"
+"    error(\"end-of-file before word complete: three bytes missing\");\n"
+"  word |= (unsigned)(unsigned char)ch << 8;\n"
+"  if ((ch = next_char()) == EOF)\n"
+"    error(\"end-of-file before word complete: two bytes missing\");\n"
+"  word |= (unsigned)(unsigned char)ch << 16;\n"
+"  if ((ch = next_char()) == EOF)\n"
+"    error(\"end-of-file before word complete: one byte missing\");\n"
+"  word |= (unsigned)(unsigned char)ch << 24;\n"
+"  *word_ptr = word;\n"
+"  return true;\n"
+"}\n"
+"\n"
+"static size_t limit = ~(size_t)0;\n"
+"static int debug;\n"
+"\n"
+"struct page {\n"
+"  unsigned words[PAGE_SIZE];\n"
+"  bool valid[PAGE_SIZE];\n"
+"};\n"
+"\n"
+"struct table {\n"
+"  struct page *pages[TABLE_SIZE];\n"
+"};\n"
+"\n"
+"static struct table *tables[TABLE_SIZE];\n"
+"\n"
+"static inline struct page *find_page(unsigned address) {\n"
+"  const struct table *table = tables[TABLE_INDEX(address)];\n"
+"  return table ? table->pages[PAGE_INDEX(address)] : 0;\n"
+"}\n"
+"\n"
+"static void write_memory(unsigned address, unsigned word) {\n"
+"  struct table **table_ptr = tables + TABLE_INDEX(address);\n"
+"  if (!*table_ptr && !(*table_ptr = calloc(1, sizeof **table_ptr)))\n"
+"    die(\"can not allocate data page table\");\n"
+"  struct page **page_ptr = (*table_ptr)->pages + PAGE_INDEX(address);\n"
+"  if (!*page_ptr && !(*page_ptr = calloc(1, sizeof **page_ptr)))\n"
+"    die(\"can not allocate data page\");\n"
+"  (*page_ptr)->words[WORD_INDEX(address)] = word;\n"
+"  (*page_ptr)->valid[WORD_INDEX(address)] = true;\n"
+"}\n"
+"\n"
+"#define STEP()                                                                 \\\n"
+"  do {                                                                         \\\n"
+"    if (steps++ == limit)                                                      \\\n"
+"      goto LIMIT;                                                              \\\n"
+"  } while (0)\n"
+"\n"
+"#define READ()                                                                 \\\n"
+"  do {                                                                         \\\n"
+"    const struct page *page = find_page(address);                              \\\n"
+"    if (!page || !page->valid[WORD_INDEX(address)]) {                         \\\n"
+"      if (debug > 0) {                                                         \\\n"
+"        warn(\"stopping on reading uninitialized 'data[0x%x]'\", address);       \\\n"
+"        return;                                                                \\\n"
+"      }                                                                        \\\n"
+"      if (!debug)                                                              \\\n"
+"        warn(\"continuing after reading uninitialized 'data[0x%x]' \"            \\\n"
+"             \"(use '-i' so squelch such messages, or '-g' to stop)\",           \\\n"
+"             address);                                                         \\\n"
+"    }                                                                          \\\n"
+"    word = page ? page->words[WORD_INDEX(address)] : 0;                        \\\n"
+"  } while (0)\n"
+"\n"
+"#define WRITE() write_memory(address, ACC)\n"
+"\n"
+;
+
+static const char * footer =
+"int main(int argc, char **argv) {\n"
+"  const char *limit_string = 0;\n"
+"  for (int i = 1; i != argc; i++) {\n"
+"    const char *arg = argv[i];\n"
+"    if (!strcmp(arg, \"-h\") || !strcmp(arg, \"--help\")) {\n"
+"      printf(\"usage: %s [ -g | -i ] [ <steps> ] [ <data> ]\\n\", argv[0]);\n"
+"      exit(0);\n"
+"    } else if (!strcmp(arg, \"-g\") || !strcmp(arg, \"--debug\"))\n"
+"      debug = 1;\n"
+"    else if (!strcmp(arg, \"-i\") || !strcmp(arg, \"--ignore\"))\n"
+"      debug = -1;\n"
+"    else if (arg[0] == '-' && arg[1])\n"
+"      die(\"invalid option '%s' (try '-h')\", arg);\n"
+"    else if (is_number_string(arg)) {\n"
+"      if (limit_string)\n"
+"        die(\"two steps limits '%s' and '%s'\", limit_string, arg);\n"
+"      if (file_exists(arg))\n"
+"        die(\"steps limit '%s' matches file '%s'\", arg, arg);\n"
+"      limit_string = arg;\n"
+"    } else if (!data_path)\n"
+"      data_path = arg;\n"
+"    else\n"
+"      die(\"more than one data file specified '%s' and '%s' (try '-h')\",\n"
+"          data_path, arg);\n"
+"  }\n"
+"  if (limit_string) {\n"
+"    const size_t max_limit = ~(size_t)0;\n"
+"    limit = 0;\n"
+"    for (const char *p = limit_string; *p; p++) {\n"
+"      const int digit = *p - '0';\n"
+"      if (max_limit / 10 < limit || max_limit - digit < 10 * limit)\n"
+"        die(\"maximum steps limit exceeded in '%s'\", limit_string);\n"
+"      limit = 10 * limit + digit;\n"
+"    }\n"
+"  }\n"
+"  if (data_path) {\n"
+"    bool close_data_file = false;\n"
+"    if (!strcmp(data_path, \"-\"))\n"
+"      data_path = \"<stdin>\", data_file = stdin;\n"
+"    else if (!file_exists(data_path))\n"
+"      die(\"data file '%s' does not exist\", data_path);\n"
+"    else if (!(data_file = fopen(data_path, \"r\")))\n"
+"      die(\"can not read data file '%s'\", data_path);\n"
+"    else\n"
+"      close_data_file = true;\n"
+"    size_t address = 0;\n"
+"    unsigned word;\n"
+"    while (next_word(&word)) {\n"
+"      if (address == CAPACITY)\n"
+"        die(\"capacity of data area reached\");\n"
+"      write_memory(address++, word);\n"
+"    }\n"
+"    if (close_data_file)\n"
+"      fclose(data_file);\n"
+"  }\n"
+"  run();\n"
+"  for (size_t i = 0; i != TABLE_SIZE; i++) {\n"
+"    struct table *table = tables[i];\n"
+"    if (!table)\n"
+"      continue;\n"
+"    for (size_t j = 0; j != TABLE_SIZE; j++) {\n"
+"      struct page *page = table->pages[j];\n"
+"      if (!page)\n"
+"        continue;\n"
+"      for (size_t k = 0; k != PAGE_SIZE; k++)\n"
+"        if (page->valid[k])\n"
+"          printf(\"%08x %08x\\n\",\n"
+"                 (unsigned)((i << (LOG_TABLE_SIZE + LOG_PAGE_SIZE)) |\n"
+"                            (j << LOG_PAGE_SIZE) | k),\n"
+"                 page->words[k]);\n"
+"      free(page);\n"
+"    }\n"
+"    free(table);\n"
+"  }\n"
+"  return 0;\n"
+"}\n"
+;
+
+// clang-format on
+
+#include "disreti.h"
+#include "reti.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static size_t bytes, words;
+static const char *input_path;
+static bool close_input_file;
+static FILE *input_file;
+
+static const char *output_path;
+static bool close_output_file;
+static FILE *output_file;
+
+static unsigned *code;
+static size_t size_code, capacity_code;
+
+static void die(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+static void die(const char *fmt, ...) {
+  fputs("reti2c: error: ", stderr);
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  exit(1);
+}
+
+static void error(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+static void error(const char *fmt, ...) {
+  fprintf(stderr,
+          "reti2c: parse error: "
+          "at byte %zu after %zu words in '%s': ",
+          bytes, words, input_path);
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  exit(1);
+}
+
+static bool file_exists(const char *path) {
+  struct stat buf;
+  return !stat(path, &buf);
+}
+
+static int read_char(void) {
+  int ch = getc(input_file);
+  if (ch != EOF)
+    bytes++;
+  return ch;
+}
+
+static bool read_word(unsigned *word_ptr) {
+  int ch = read_char();
+  if (ch == EOF)
+    return false;
+  unsigned word = (unsigned)(ch & 0xff);
+  ch = read_char();
+  if (ch == EOF)
+    error("three bytes of word missing");
+  word |= (unsigned)(ch & 0xff) << 8;
+  ch = read_char();
+  if (ch == EOF)
+    error("two bytes of word missing");
+  word |= (unsigned)(ch & 0xff) << 16;
+  ch = read_char();
+  if (ch == EOF)
+    error("last byte of word missing");
+  word |= (unsigned)(ch & 0xff) << 24;
+  *word_ptr = word;
+  words++;
+  return true;
+}
+
+static void push_code(unsigned word) {
+  if (size_code == capacity_code) {
+    capacity_code = capacity_code ? 2 * capacity_code : 1024;
+    code = realloc(code, capacity_code * sizeof *code);
+    if (!code)
+      die("out-of-memory reallocating code");
+  }
+  code[size_code++] = word;
+}
+
+//----------------------------------------------------------------------------//
+
+static const char *register_names[4] = {"PC", "IN1", "IN2", "ACC"};
+
+// The value of register 'S' as C expression.  The 'PC' is a constant.
+
+static void print_register(unsigned S, unsigned PC) {
+  if (S)
+    fputs(register_names[S], output_file);
+  else
+    fprintf(output_file, "0x%xu", PC);
+}
+
+// Writing the 'PC' continues at a computed instruction unless it is the
+// same instruction which stops the program (self-loop).
+
+static void print_write_pc(unsigned PC, const char *expression) {
+  fprintf(output_file,
+          "  pc = %s;\n"
+          "  if (pc == 0x%xu)\n"
+          "    return;\n"
+          "  goto DISPATCH;\n",
+          expression, PC);
+}
+
+// Print a (conditional) jump to 'target' where 'condition' is an 'if'
+// condition or zero for unconditional jumps.
+
+static void print_jump(unsigned PC, unsigned target, const char *condition) {
+  const char *indent = "  ";
+  if (condition) {
+    fprintf(output_file, "  if (%s) {\n", condition);
+    indent = "    ";
+  }
+  if (target == PC)
+    fprintf(output_file, "%sreturn;\n", indent);
+  else if (target < size_code)
+    fprintf(output_file, "%sgoto L%u;\n", indent, target);
+  else
+    fprintf(output_file, "%spc = 0x%xu;\n%sgoto UNDEFINED;\n", indent,
+            target, indent);
+  if (condition)
+    fputs("  }\n", output_file);
+}
+
+// The address of load and store instructions (direct or indexed).
+
+static void print_address(enum opcode opcode, unsigned i, unsigned signed_i) {
+  if (opcode == LOAD || opcode == STORE)
+    fprintf(output_file, "  address = 0x%xu;\n", i);
+  else {
+    const bool in1 = opcode == LOADIN1 || opcode == STOREIN1;
+    fprintf(output_file, "  address = %s + 0x%xu;\n", in1 ? "IN1" : "IN2",
+            signed_i);
+  }
+}
+
+// Translate the instruction 'I' at 'PC' into straight-line C code.
+
+static void translate(unsigned PC, unsigned I) {
+
+  const unsigned S = (I >> 26) & 3;
+  const unsigned D = (I >> 24) & 3;
+  const unsigned i = I & 0xffffff;
+  const unsigned signed_i = (i >> 23) ? (0xff000000 | i) : i;
+  const char *destination = register_names[D];
+
+  char instruction[disassembled_reti_code_length];
+  if (!disassemble_reti_code(I, instruction))
+    strcpy(instruction, "illegal");
+  fprintf(output_file, "L%u: // %s\n  STEP();\n", PC, instruction);
+
+  const char *op = 0;
+  const char *address = 0;
+  unsigned immediate = i;
+
+  const enum opcode opcode = reti_opcode(I);
+  switch (opcode) {
+
+  case LOAD:
+  case LOADIN1:
+  case LOADIN2:
+    print_address(opcode, i, signed_i);
+    fputs("  READ();\n", output_file);
+    if (D)
+      fprintf(output_file, "  %s = word;\n", destination);
+    else
+      print_write_pc(PC, "word");
+    return;
+
+  case LOADI:
+    if (D) {
+      fprintf(output_file, "  %s = 0x%xu;\n", destination, i);
+    } else {
+      char expression[16];
+      sprintf(expression, "0x%xu", i);
+      print_write_pc(PC, expression);
+    }
+    return;
+
+  case STORE:
+  case STOREIN1:
+  case STOREIN2:
+    print_address(opcode, i, signed_i);
+    fputs("  WRITE();\n", output_file);
+    return;
+
+  case MOVE:
+    if (D) {
+      fprintf(output_file, "  %s = ", destination);
+      print_register(S, PC);
+      fputs(";\n", output_file);
+    } else if (S)
+      print_write_pc(PC, register_names[S]);
+    else
+      fputs("  return;\n", output_file);
+    return;
+
+  case SUBI:
+    op = "-", immediate = signed_i;
+    break;
+  case ADDI:
+    op = "+", immediate = signed_i;
+    break;
+  case OPLUSI:
+    op = "^";
+    break;
+  case ORI:
+    op = "|";
+    break;
+  case ANDI:
+    op = "&";
+    break;
+  case SUB:
+    op = "-", address = "word";
+    break;
+  case ADD:
+    op = "+", address = "word";
+    break;
+  case OPLUS:
+    op = "^", address = "word";
+    break;
+  case OR:
+    op = "|", address = "word";
+    break;
+  case AND:
+    op = "&", address = "word";
+    break;
+
+  case NOP:
+    return;
+  case JUMPGT:
+    print_jump(PC, PC + signed_i, "(int)ACC > 0");
+    return;
+  case JUMPEQ:
+    print_jump(PC, PC + signed_i, "(int)ACC == 0");
+    return;
+  case JUMPGE:
+    print_jump(PC, PC + signed_i, "(int)ACC >= 0");
+    return;
+  case JUMPLT:
+    print_jump(PC, PC + signed_i, "(int)ACC < 0");
+    return;
+  case JUMPNE:
+    print_jump(PC, PC + signed_i, "(int)ACC != 0");
+    return;
+  case JUMPLE:
+    print_jump(PC, PC + signed_i, "(int)ACC <= 0");
+    return;
+  case JUMP:
+    print_jump(PC, PC + signed_i, 0);
+    return;
+
+  case ILLEGAL:
+    fprintf(output_file,
+            "  die(\"illegal instruction '0x%%08x' at 'code[0x%%08x]'\", "
+            "0x%xu, 0x%xu);\n",
+            I, PC);
+    return;
+  }
+
+  assert(op);
+
+  char operand[16];
+  if (address) {
+    fprintf(output_file, "  address = 0x%xu;\n  READ();\n", i);
+    strcpy(operand, address);
+  } else
+    sprintf(operand, "0x%xu", immediate);
+
+  if (D)
+    fprintf(output_file, "  %s %s= %s;\n", destination, op, operand);
+  else {
+    char expression[48];
+    sprintf(expression, "0x%xu %s %s", PC, op, operand);
+    print_write_pc(PC, expression);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv) {
+  for (int i = 1; i != argc; i++) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+      fputs(usage, stdout);
+      exit(0);
+    } else if (arg[0] == '-' && arg[1])
+      die("invalid option '%s' (try '-h')", arg);
+    else if (!input_path)
+      input_path = arg;
+    else if (!output_path)
+      output_path = arg;
+    else
+      die("too many files '%s', '%s' and '%s' (try '-h')", input_path,
+          output_path, arg);
+  }
+
+  if (!input_path || !strcmp(input_path, "-"))
+    input_path = "<stdin>", input_file = stdin;
+  else if (!file_exists(input_path))
+    die("could not find input file '%s'", input_path);
+  else if (!(input_file = fopen(input_path, "r")))
+    die("could not read input file '%s'", input_path);
+  else
+    close_input_file = true;
+
+  unsigned word;
+  while (read_word(&word))
+    push_code(word);
+
+  if (close_input_file)
+    fclose(input_file);
+
+  if (!output_path || !strcmp(output_path, "-"))
+    output_path = "<stdout>", output_file = stdout;
+  else if (!(output_file = fopen(output_path, "w")))
+    die("could not write output file '%s'", output_path);
+  else
+    close_output_file = true;
+
+  fprintf(output_file,
+          "// Generated by 'reti2c' from '%s' (%zu instructions).\n\n",
+          input_path, size_code);
+  fputs(header, output_file);
+
+  // All instructions are translated in order into one function, such that
+  // falling through to the next instruction is just the next statement.
+  // The 'PC' is only kept in 'pc' if it is computed ('DISPATCH').
+
+  fputs("static void run(void) {\n"
+        "  unsigned IN1 = 0, IN2 = 0, ACC = 0, pc = 0, address = 0, word;\n"
+        "  (void)IN1, (void)IN2, (void)ACC, (void)address, (void)word;\n"
+        "  size_t steps = 0;\n"
+        "  goto DISPATCH;\n",
+        output_file);
+
+  for (size_t PC = 0; PC != size_code; PC++)
+    translate(PC, code[PC]);
+
+  fprintf(output_file,
+          "  pc = 0x%zxu;\n"
+          "UNDEFINED:\n"
+          "  if (steps++ == limit)\n"
+          "    goto LIMIT;\n"
+          "  if (pc != 0x%zxu)\n"
+          "    warn(\"stopping at undefined 'code[0x%%08x]' above 0x%%08x\", "
+          "pc, 0x%xu);\n"
+          "  return;\n"
+          "LIMIT:\n"
+          "  warn(\"steps limit '%%zu' reached\", limit);\n"
+          "  return;\n"
+          "DISPATCH:\n"
+          "  switch (pc) {\n",
+          size_code, size_code, (unsigned)(size_code - 1));
+  for (size_t PC = 0; PC != size_code; PC++)
+    fprintf(output_file, "  case 0x%zxu:\n    goto L%zu;\n", PC, PC);
+  fputs("  default:\n"
+        "    goto UNDEFINED;\n"
+        "  }\n"
+        "}\n\n",
+        output_file);
+
+  fputs(footer, output_file);
+
+  if (close_output_file)
+    fclose(output_file);
+
+  free(code);
+
+  return 0;
+}
@@ -17,6 +17,7 @@ static const char * usage =
 // clang-format on
 
 #include "disreti.h"
+#include "reti.h"
 
 #include <ctype.h>     // isdigit
 #include <inttypes.h>  // PRIu64
@@ -259,29 +260,29 @@ int main(int argc, char **argv) {
     // Restrict immedidates to small negative and positive numbers.
 
     const unsigned type = code >> 30;
-    const unsigned mode = (code >> 28) & 3;
-    const unsigned comparison = (code >> 27) & 7;
 
     if (type != 1 && type != 2 && (code & 0x00800000))
       code |= 0x00ffffe0;
     else
       code &= 0xff00001f;
 
-    // Force irrelevant '*' to '0'.
+    const enum opcode opcode = reti_opcode(code);
+    if (opcode == ILLEGAL)
+      continue;
 
-    if (type == 1)         // LOAD
-      code &= ~0x0c000000; // force S to zero
-    if (type == 2) {
-      if (mode == 3)         // MOVE
-        code &= 0xff000000;  // force immediate to zero
-      else                   // STORE
-        code &= ~0x0f000000; // force S and D to zero
-    }
-    if (type == 3) {       // JUMP
-      code &= ~0x07000000; // force the 3 bits to zero
-      if (comparison == 0 || comparison == 7)
-        code &= 0xff000000; // force zero immediate
-    }
+    // Force irrelevant '*' to '0', i.e., all bits which are neither part of
+    // the prefix nor of an operand of the instruction.  The immediate of
+    // 'JUMP' is forced to zero too.
+
+    const unsigned operands = reti_instructions[opcode].operands;
+    unsigned relevant = ~0u << (32 - reti_instructions[opcode].bits);
+    if (operands == RETI_S_D)
+      relevant |= 0x0f000000; // S and D
+    else if (operands == RETI_D_I)
+      relevant |= 0x03000000; // D
+    if ((operands == RETI_D_I || operands == RETI_I) && opcode != JUMP)
+      relevant |= 0x00ffffff; // immediate
+    code &= relevant;
 
     // Now disassamble for printing.
 
@@ -300,7 +301,7 @@ int main(int argc, char **argv) {
     if (code & 0x00800000) // something with a negative immediate
       pos = pick32(0, 7);
     else if (type == 2) {
-      if (mode == 3) // MOVE thus only first two nibbles.
+      if (opcode == MOVE) // Thus only first two nibbles.
         pos = pick32(0, 1);
       else { // STORE
         pos = pick32(0, 2);
@@ -309,7 +310,7 @@ int main(int argc, char **argv) {
       }
     } else {
       pos = pick32(0, 3);
-      if (type == 3 && (comparison == 0 || comparison == 7))
+      if (opcode == NOP || opcode == JUMP)
         pos &= 1;
       else {
         assert(pos < 4);
@@ -0,0 +1,196 @@
+// clang-format off
+
+static const char * usage =
+"usage: trcreti [ -h | --help ] [ --from=<step> ] [ --to=<step> ]"
+" [ <trace> [ <output> ] ]\n"
+"\n"
+"Formats a binary trace written by 'emreti --trace=<trace>' in the same\n"
+"way as 'emreti --step' prints executed instructions.  With '--from' and\n"
+"'--to' only the given range of steps is printed, where the first step\n"
+"is found by binary search in the trace (unless read from '<stdin>').\n";
+
+// clang-format on
+
+#include "trcreti.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static const char *input_path;
+static bool close_input_file;
+static FILE *input_file;
+
+static const char *output_path;
+static bool close_output_file;
+static FILE *output_file;
+
+static void die(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+static void die(const char *fmt, ...) {
+  fputs("trcreti: error: ", stderr);
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  exit(1);
+}
+
+static bool file_exists(const char *path) {
+  struct stat buf;
+  return !stat(path, &buf);
+}
+
+static uint64_t parse_step(const char *arg, const char *str) {
+  if (!*str)
+    die("missing step in '%s'", arg);
+  uint64_t res = 0;
+  for (const char *p = str; *p; p++) {
+    if (!isdigit(*p))
+      die("invalid step in '%s'", arg);
+    const unsigned digit = *p - '0';
+    if ((UINT64_MAX - digit) / 10 < res)
+      die("step in '%s' too large", arg);
+    res = 10 * res + digit;
+  }
+  return res;
+}
+
+//----------------------------------------------------------------------------//
+
+// Records are read in large blocks.
+
+#define RECORDS (1u << 12)
+
+static struct reti_trace_record records[RECORDS];
+static size_t size_records, next_record;
+static uint64_t read_records; // Records read before the current block.
+
+static const struct reti_trace_record *read_record(void) {
+  if (next_record == size_records) {
+    read_records += size_records;
+    size_records = fread(records, sizeof *records, RECORDS, input_file);
+    next_record = 0;
+    if (!size_records) {
+      if (ferror(input_file))
+        die("can not read trace file '%s'", input_path);
+      if (fgetc(input_file) != EOF)
+        die("truncated record %" PRIu64 " in trace file '%s'", read_records,
+            input_path);
+      return 0;
+    }
+  }
+  return records + next_record++;
+}
+
+// Finds the first record with 'steps' larger or equal than 'from'.  The
+// records are sorted by 'steps' thus we can use binary search in a trace
+// file with 'size' records.
+
+static uint64_t find_record(uint64_t size, uint64_t from) {
+  uint64_t l = 0, r = size;
+  while (l < r) {
+    const uint64_t m = l + (r - l) / 2;
+    const off_t offset = sizeof(struct reti_trace_header) + m * sizeof *records;
+    struct reti_trace_record record;
+    if (fseeko(input_file, offset, SEEK_SET) ||
+        fread(&record, sizeof record, 1, input_file) != 1)
+      die("can not read record %" PRIu64 " in trace file '%s'", m,
+          input_path);
+    if (record.steps < from)
+      l = m + 1;
+    else
+      r = m;
+  }
+  const off_t offset = sizeof(struct reti_trace_header) + l * sizeof *records;
+  if (fseeko(input_file, offset, SEEK_SET))
+    die("can not seek in trace file '%s'", input_path);
+  return l;
+}
+
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv) {
+  uint64_t from = 0, to = UINT64_MAX;
+  for (int i = 1; i != argc; i++) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+      fputs(usage, stdout);
+      exit(0);
+    } else if (!strncmp(arg, "--from=", 7))
+      from = parse_step(arg, arg + 7);
+    else if (!strncmp(arg, "--to=", 5))
+      to = parse_step(arg, arg + 5);
+    else if (arg[0] == '-' && arg[1])
+      die("invalid option '%s' (try '-h')", arg);
+    else if (!input_path)
+      input_path = arg;
+    else if (!output_path)
+      output_path = arg;
+    else
+      die("too many files '%s', '%s' and '%s' (try '-h')", input_path,
+          output_path, arg);
+  }
+
+  if (!input_path || !strcmp(input_path, "-"))
+    input_path = "<stdin>", input_file = stdin;
+  else if (!file_exists(input_path))
+    die("could not find trace file '%s'", input_path);
+  else if (!(input_file = fopen(input_path, "r")))
+    die("could not read trace file '%s'", input_path);
+  else
+    close_input_file = true;
+
+  struct reti_trace_header header;
+  if (fread(&header, sizeof header, 1, input_file) != 1 ||
+      memcmp(header.magic, reti_trace_magic, sizeof header.magic))
+    die("'%s' is not a trace file", input_path);
+  if (header.record_size != sizeof(struct reti_trace_record))
+    die("unsupported record size %u in trace file '%s'", header.record_size,
+        input_path);
+
+  if (!output_path || !strcmp(output_path, "-"))
+    output_path = "<stdout>", output_file = stdout;
+  else if (!(output_file = fopen(output_path, "w")))
+    die("could not write output file '%s'", output_path);
+  else
+    close_output_file = true;
+
+  // Skip to the first record to print.  Without seeking (say reading from
+  // a pipe) the records before are read and dropped.
+
+  struct stat buf;
+  if (from > 1 && close_input_file && !fstat(fileno(input_file), &buf) &&
+      S_ISREG(buf.st_mode)) {
+    const uint64_t size = (buf.st_size - sizeof header) / sizeof *records;
+    read_records = find_record(size, from);
+  }
+
+  char line[formatted_reti_trace_length];
+  bool printed = false;
+  const struct reti_trace_record *record;
+  while ((record = read_record()) && record->steps <= to) {
+    if (record->steps < from)
+      continue;
+    if (!printed && record->steps != 1 && record->kind == RETI_TRACE_STEP)
+      fwrite(line, format_reti_trace_header(header.instruction_length, line),
+             1, output_file);
+    fwrite(line, format_reti_trace(record, header.instruction_length, line), 1,
+           output_file);
+    printed = true;
+  }
+
+  if (close_input_file)
+    fclose(input_file);
+  if (fflush(output_file))
+    die("could not write output file '%s'", output_path);
+  if (close_output_file)
+    fclose(output_file);
+
+  return 0;
+}
@@ -0,0 +1,275 @@
+#ifndef _trcreti_h_INCLUDED
+#define _trcreti_h_INCLUDED
+
+#include "disreti.h"
+#include "reti.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A binary trace written by 'emreti --trace=<trace>' consists of a header
+// followed by fixed size step records, which allows 'trcreti' to seek to
+// any step without reading the trace up to that point.  Both are written
+// in the byte order of the host.
+
+#define reti_trace_magic "ReTItrc1"
+
+struct reti_trace_header {
+  char magic[8];               // Always 'reti_trace_magic'.
+  uint32_t record_size;        // Always 'sizeof (struct reti_trace_record)'.
+  uint32_t instruction_length; // Width of the 'INSTRUCTION' column.
+};
+
+// One record is written per executed step before it changes the state.
+// The registers, the memory address and the word read from memory are
+// enough to reconstruct the printed action of the instruction.  Reaching
+// undefined code and detecting a self-loop (infinite loop) is recorded as
+// its own record with the same 'steps' as the previous step record.  The
+// flight recorder of 'emreti' also records entering a basic block by its
+// fast engine with only the 'steps' and 'PC' of its first step (never
+// traced), thus its registers are printed as dots.
+
+enum reti_trace_kind {
+  RETI_TRACE_STEP,
+  RETI_TRACE_UNDEFINED,
+  RETI_TRACE_LOOP,
+  RETI_TRACE_BLOCK,
+};
+
+struct reti_trace_record {
+  uint64_t steps;
+  uint32_t kind; // Actually an 'enum reti_trace_kind'.
+  uint32_t PC, code, IN1, IN2, ACC;
+  uint32_t address; // Read from or written to (if memory is accessed).
+  uint32_t loaded;  // Word read from memory (if memory is read).
+};
+
+// Long enough for the longest line including a header line.
+
+#define formatted_reti_trace_length 384
+
+// The header line of 'emreti --step' (printed before the first step).
+
+static inline size_t format_reti_trace_header(unsigned instruction_length,
+                                              char *line) {
+  const int length = sprintf(line,
+                             "STEPS    PC       CODE     IN1      IN2      "
+                             "ACC      %-*s ACTION\n",
+                             (int)instruction_length, "INSTRUCTION");
+  assert(length > 0);
+  return length;
+}
+
+// Format the record as line of 'emreti --step' into 'line' and return the
+// length of the (zero terminated) line including the new-line character.
+// The header line is printed before the first step.
+
+static inline size_t
+format_reti_trace(const struct reti_trace_record *record,
+                  unsigned instruction_length, char *line) {
+
+  static const char *const register_symbols[4] = {"PC", "IN1", "IN2", "ACC"};
+  const uint64_t steps = record->steps;
+  const unsigned PC = record->PC, I = record->code;
+  const unsigned IN1 = record->IN1, IN2 = record->IN2, ACC = record->ACC;
+  const int width = instruction_length;
+  int length = 0;
+
+#define PRINT(...)                                                             \
+  do {                                                                         \
+    const size_t remaining = formatted_reti_trace_length - length;             \
+    const int printed = snprintf(line + length, remaining, __VA_ARGS__);       \
+    assert(printed >= 0);                                                      \
+    length += printed;                                                         \
+    assert(length < formatted_reti_trace_length);                              \
+  } while (0)
+
+  if (record->kind == RETI_TRACE_UNDEFINED) {
+    if (steps == 1)
+      PRINT("STEPS    PC       CODE     IN1      IN2      ACC\n");
+    PRINT("%-8" PRIu64 " %08x ........ %08x %08x %08x <undefined>\n", steps,
+          PC, IN1, IN2, ACC);
+    return length;
+  }
+
+  if (record->kind == RETI_TRACE_LOOP) {
+    if (steps == 1)
+      PRINT("STEPS   PC       CODE     IN1      IN2      ACC\n");
+    PRINT("%-8" PRIu64 " %08x %08x %08x %08x %08x <infinite-loop>\n", steps,
+          PC, I, IN1, IN2, ACC);
+    return length;
+  }
+
+  if (steps == 1)
+    length += format_reti_trace_header(instruction_length, line);
+
+  char instruction[disassembled_reti_code_length];
+  format_reti_code(I, instruction);
+
+  if (record->kind == RETI_TRACE_BLOCK) {
+    PRINT("%-8" PRIu64 " %08x %08x ........ ........ ........ %-*s "
+          "<basic-block>\n",
+          steps, PC, I, width, instruction);
+    return length;
+  }
+
+  assert(record->kind == RETI_TRACE_STEP);
+  PRINT("%-8" PRIu64 " %08x %08x %08x %08x %08x %-*s ", steps, PC, I, IN1, IN2,
+        ACC, width, instruction);
+
+  // The registers before executing the instruction and its operands.
+
+  const unsigned R[4] = {PC, IN1, IN2, ACC};
+  const unsigned i = I & 0xffffff;
+  const unsigned signed_immediate = (unsigned)((int)(i << 8) >> 8);
+  const int sign_char = (i >> 23) ? '-' : '+';
+  const int abs_immediate = abs((int)signed_immediate);
+  const char *S_symbol = register_symbols[(I >> 26) & 3];
+  const char *D_symbol = register_symbols[(I >> 24) & 3];
+  const unsigned D = R[(I >> 24) & 3];
+  const unsigned address = record->address;
+  const unsigned loaded = record->loaded;
+
+  // The action of all jumps is the same after determining 'taken'.
+
+  bool taken = false;
+  const char *comparison = 0;
+
+  const enum opcode opcode = reti_opcode(I);
+  switch (opcode) {
+
+    // Load Instructions
+
+  case LOAD:
+    PRINT("%s = M(<0x%x>) = M(0x%x) = 0x%x", D_symbol, i, address, loaded);
+    break;
+  case LOADIN1:
+    PRINT("%s = M(<IN1> + <0x%x>) = M(0x%x + 0x%x) = M(0x%x) = 0x%x",
+          D_symbol, i, IN1, i, address, loaded);
+    break;
+  case LOADIN2:
+    PRINT("%s = M(<IN2> + <0x%x>) = M(0x%x + 0x%x) = M(0x%x) = 0x%x",
+          D_symbol, i, IN2, i, address, loaded);
+    break;
+  case LOADI:
+    PRINT("%s = 0x%x", D_symbol, i);
+    break;
+
+    // Store Instructions
+
+  case STORE:
+    PRINT("M(<%u>) = M(0x%x) = 0x%x", i, address, ACC);
+    break;
+  case STOREIN1:
+    PRINT("M(0x%x) = M(<IN1> + <0x%x>) = M(0x%x + 0x%x) = ACC = 0x%x",
+          address, i, IN1, i, ACC);
+    break;
+  case STOREIN2:
+    PRINT("M(0x%x) = M(<IN2> + <0x%x>) = M(0x%x + 0x%x) = ACC = 0x%x",
+          address, i, IN2, i, ACC);
+    break;
+  case MOVE:
+    PRINT("%s = %s = 0x%x", D_symbol, S_symbol, R[(I >> 26) & 3]);
+    break;
+
+    // Compute Instructions
+
+  case SUBI:
+    PRINT("%s = %s - [0x%x] = %d - %d = %d = [0x%x]", D_symbol, D_symbol, i,
+          (int)D, (int)i, (int)(D - signed_immediate), D - signed_immediate);
+    break;
+  case ADDI:
+    PRINT("%s = %s + [0x%x] = %d + %d = %d = [0x%x]", D_symbol, D_symbol, i,
+          (int)D, (int)i, (int)(D + signed_immediate), D + signed_immediate);
+    break;
+  case OPLUSI:
+    PRINT("%s = %s ^ 0x%x = 0x%x ^ 0x%x = 0x%x", D_symbol, D_symbol, i, D, i,
+          D ^ i);
+    break;
+  case ORI:
+    PRINT("%s = %s | 0x%x = 0x%x | 0x%x = 0x%x", D_symbol, D_symbol, i, D, i,
+          D | i);
+    break;
+  case ANDI:
+    PRINT("%s = %s & 0x%x = 0x%x & 0x%x = 0x%x", D_symbol, D_symbol, i, D, i,
+          D & i);
+    break;
+  case SUB:
+    PRINT("%s = %s - M(<0x%x>) = %s - [0x%x] = %d - %d = %d = [0x%x]",
+          D_symbol, D_symbol, i, D_symbol, loaded, (int)D, (int)loaded,
+          (int)(D - loaded), D - loaded);
+    break;
+  case ADD:
+    PRINT("%s = %s + M(<0x%x>) = %s + [0x%x] = %d + %d = %d = [0x%x]",
+          D_symbol, D_symbol, i, D_symbol, loaded, (int)D, (int)loaded,
+          (int)(D + loaded), D + loaded);
+    break;
+  case OPLUS:
+    PRINT("%s = %s ^ M(<0x%x>) = 0x%x ^ 0x%x = 0x%x", D_symbol, D_symbol, i,
+          D, loaded, D ^ loaded);
+    break;
+  case OR:
+    PRINT("%s = %s | M(<0x%x>) = 0x%x | 0x%x = 0x%x", D_symbol, D_symbol, i,
+          D, loaded, D | loaded);
+    break;
+  case AND:
+    PRINT("%s = %s & M(<0x%x>) = 0x%x & 0x%x = 0x%x", D_symbol, D_symbol, i,
+          D, loaded, D & loaded);
+    break;
+
+    // Jump Instructions
+
+  case NOP:
+    break;
+  case JUMPGT:
+    taken = ((int)ACC > 0);
+    comparison = taken ? ">" : "<=";
+    break;
+  case JUMPEQ:
+    taken = ((int)ACC == 0);
+    comparison = taken ? "=" : "!=";
+    break;
+  case JUMPGE:
+    taken = ((int)ACC >= 0);
+    comparison = taken ? ">=" : "<";
+    break;
+  case JUMPLT:
+    taken = ((int)ACC < 0);
+    comparison = taken ? "<" : ">=";
+    break;
+  case JUMPNE:
+    taken = ((int)ACC != 0);
+    comparison = taken ? "!=" : "=";
+    break;
+  case JUMPLE:
+    taken = ((int)ACC <= 0);
+    comparison = taken ? "<=" : ">";
+    break;
+  case JUMP:
+    taken = true;
+    break;
+
+  default:
+    assert(opcode == ILLEGAL);
+    break;
+  }
+
+  if (taken) {
+    const unsigned PC_next = PC + signed_immediate;
+    PRINT("PC = PC + [0x%x] = %u %c %d = %u = 0x%x", i, PC, sign_char,
+          abs_immediate, PC_next, PC_next);
+    if (comparison)
+      PRINT(" as %d = [0x%x] = ACC %s 0", (int)ACC, ACC, comparison);
+  } else if (comparison)
+    PRINT("no jump as %d = [0x%x] = ACC %s 0", (int)ACC, ACC, comparison);
+
+  PRINT("\n");
+
+#undef PRINT
+
+  return length;
+}
+
+#endif